@@ -0,0 +1,535 @@
+#include "aggregator.hpp"
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <time.h>
+
+Aggregator::Aggregator(std::shared_ptr<const Filter> filter)
+    : filter(filter) {}
+
+Aggregator::~Aggregator() {}
+
+void Aggregator::setSplitPids(bool split) {
+  // Entries are keyed by process from the first event on, so this is only
+  // meaningful before events are processed.
+  std::lock_guard lck(mtxParams);
+  splitPids = split;
+}
+
+void Aggregator::setStats(std::shared_ptr<const TracerStats> st) {
+  std::lock_guard lck(mtxParams);
+  stats = st;
+}
+
+void Aggregator::setSampling(std::chrono::milliseconds on,
+                             std::chrono::milliseconds period) {
+  std::lock_guard lck(mtxParams);
+  sampleOn = on;
+  samplePeriod = period;
+}
+
+void Aggregator::setSymbolizer(std::shared_ptr<Symbolizer> s) {
+  std::lock_guard lck(mtxParams);
+  symbolizer = s;
+}
+
+void Aggregator::setMaxEntries(size_t count) {
+  std::lock_guard lck(mtxParams);
+  maxEntries = count;
+}
+
+void Aggregator::publish() {
+  auto snap = std::make_shared<const Snapshot>(makeSnapshot());
+  std::lock_guard lck(mtxPublished);
+  published = std::move(snap);
+}
+
+std::shared_ptr<const Snapshot> Aggregator::snapshot() const {
+  std::lock_guard lck(mtxPublished);
+  return published;
+}
+
+Aggregator::Entry *Aggregator::process(EventInfo &info) {
+  if (info.type == Event::Exit) {
+    closeProcessFds(info.tgid);
+    // The pid may be reused by a process which mapped none of them.
+    mappedFiles.erase(mappedFiles.lower_bound({info.tgid, {}}),
+                      mappedFiles.lower_bound({info.tgid + 1, {}}));
+    return nullptr;
+  }
+  if (info.path.empty())
+    return nullptr;
+  // Sockets, pipes and anonymous inodes are named "type:..." by the tracer.
+  if (info.path.front() == '/') {
+    info.path = fixRelativePath(info.path);
+    if (!info.strArg.empty())
+      info.strArg = fixRelativePath(info.strArg);
+  }
+  processes.insert(info.tgid);
+  pid_t keyPid = splitPids ? info.tgid : 0;
+  auto [item, inserted] = info.id.ino ? getEntry(info.id, info.path, keyPid)
+                                      : getEntry(info.path, keyPid);
+  if (inserted)
+    item.filtered = filter->matches(info.path);
+  // Paths of open files are refreshed by the tracer now and then.
+  else if (item.path != info.path && info.type != Event::Rename)
+    setPath(item, info.path);
+  item.pid = info.tgid;
+  item.lastThread = info.pid;
+  item.lastAccess = info.time;
+  eventCounts[static_cast<size_t>(info.type)] += info.count;
+  if (!info.exists)
+    item.specialEvents |= Entry::EventUnlinked;
+  if (!info.stack.empty())
+    countCallSite(item, info);
+  switch (info.type) {
+  case Event::Open: {
+    ++item.openCount;
+    trackOpen(item, info);
+    break;
+  }
+  case Event::Close: {
+    ++item.closeCount;
+    trackClose(info);
+    break;
+  }
+  case Event::Read: {
+    // Coalesced operations are counted with their average size.
+    item.readCount += info.count;
+    item.readSize += info.sizeArg;
+    sizes(item).read[sizeBucket(info.sizeArg / info.count)] += info.count;
+    break;
+  }
+  case Event::Write: {
+    item.writeCount += info.count;
+    item.writeSize += info.sizeArg;
+    sizes(item).write[sizeBucket(info.sizeArg / info.count)] += info.count;
+    break;
+  }
+  case Event::Map: {
+    item.specialEvents |= Entry::EventMapped;
+    mappedFiles.emplace(info.tgid, info.path);
+    break;
+  }
+  case Event::Rename: {
+    // The statistics stay with the file; a file it replaced is gone.
+    item.specialEvents |= Entry::EventRenamed;
+    if (Entry *replaced = setPath(item, info.strArg))
+      replaced->specialEvents |= Entry::EventUnlinked;
+    break;
+  }
+  case Event::Unlink: {
+    item.specialEvents |= Entry::EventUnlinked;
+    break;
+  }
+  case Event::Sync: {
+    ++item.syncCount;
+    item.syncTime += info.duration;
+    item.syncMaxTime = std::max(item.syncMaxTime, info.duration);
+    break;
+  }
+  case Event::Exit: {
+    break;
+  }
+  }
+  return &item;
+}
+
+void Aggregator::evictEntries() {
+  size_t limit;
+  {
+    std::lock_guard lck(mtxParams);
+    limit = maxEntries;
+  }
+  if (!limit || list.size() <= limit)
+    return;
+  // The *EVICTED* row counts against the limit. A tenth of the limit is
+  // evicted at once to amortize the scan.
+  size_t keep = limit - 1 - (limit - 1) / 10;
+  auto &evicted = getEntry(evictedPath).first;
+  evicted.filtered = true;
+  std::vector<std::list<Entry>::iterator> victims;
+  victims.reserve(list.size());
+  for (auto it = list.begin(); it != list.end(); ++it)
+    if (&*it != &evicted)
+      victims.push_back(it);
+  if (victims.size() <= keep)
+    return;
+  auto activity = [](const Entry &e) {
+    return e.openCount + e.closeCount + e.readCount + e.writeCount +
+           e.syncCount;
+  };
+  auto colder = [&](auto a, auto b) {
+    if (a->lastAccess != b->lastAccess)
+      return a->lastAccess < b->lastAccess;
+    return activity(*a) < activity(*b);
+  };
+  auto split = victims.end() - keep;
+  std::nth_element(victims.begin(), split, victims.end(), colder);
+  victims.erase(split, victims.end());
+  std::unordered_set<const Entry *> removed;
+  for (auto it : victims)
+    removed.insert(&*it);
+  onEvict(removed, evicted);
+  for (auto it : victims) {
+    mergeEntry(evicted, *it);
+    evicted.specialEvents |= it->specialEvents;
+    evicted.lastAccess = std::max(evicted.lastAccess, it->lastAccess);
+  }
+  eraseEntries(victims, evicted);
+  evictedCount += victims.size();
+}
+
+void Aggregator::onEvict(const std::unordered_set<const Entry *> &,
+                         Entry &) {}
+
+Snapshot Aggregator::makeSnapshot() {
+  updateScale();
+  // Snapshots are compared by path: split processes and files replaced at
+  // the same path are merged.
+  bool merge = splitPids || list.size() != hashmap.size();
+  std::unordered_map<std::string_view, Entry> merged;
+  std::vector<const Entry *> entries;
+  for (const auto &e : list) {
+    if (!e.filtered)
+      continue;
+    if (!merge) {
+      entries.push_back(&e);
+      continue;
+    }
+    auto [it, inserted] = merged.try_emplace(e.path);
+    Entry &m = it->second;
+    if (inserted) {
+      m.path = e.path;
+      entries.push_back(&m);
+    }
+    mergeEntry(m, e);
+    m.specialEvents |= e.specialEvents;
+    m.cachedPercent = std::max(m.cachedPercent, e.cachedPercent);
+    if (e.lastAccess >= m.lastAccess) {
+      m.lastAccess = e.lastAccess;
+      m.pid = e.pid;
+      m.lastThread = e.lastThread;
+    }
+  }
+  std::vector<std::string> names(std::next(std::cbegin(columnNames)),
+                                 std::cend(columnNames));
+  Snapshot snapshot(names);
+  std::vector<int64_t> values(names.size());
+  for (auto e : entries) {
+    for (size_t col = ColPath + 1; col < ColumnsCount; ++col)
+      values[col - 1] = columnValue(*e, static_cast<Column>(col));
+    snapshot.add(e->path, values);
+  }
+  return snapshot;
+}
+
+int64_t Aggregator::columnValue(const Entry &entry, Column column) const {
+  switch (column) {
+  case ColWriteSize:
+    return estimate(entry.writeSize);
+  case ColReadSize:
+    return estimate(entry.readSize);
+  case ColWriteCount:
+    return estimate(entry.writeCount);
+  case ColReadCount:
+    return estimate(entry.readCount);
+  case ColWriteAvg:
+    return average(entry.writeSize, entry.writeCount);
+  case ColReadAvg:
+    return average(entry.readSize, entry.readCount);
+  case ColSmallOps:
+    return smallOpsPercent(entry);
+  case ColOpenCount:
+    return estimate(entry.openCount);
+  case ColCloseCount:
+    return estimate(entry.closeCount);
+  case ColOpenNow:
+    return entry.openNow;
+  case ColOpenAvg:
+    return average(entry.lifetime, entry.lifetimeCount);
+  case ColOpenMax:
+    return entry.lifetimeMax;
+  case ColUnclosed:
+    return entry.unclosedCount;
+  case ColSyncCount:
+    return estimate(entry.syncCount);
+  case ColSyncTime:
+    return estimate(entry.syncTime);
+  case ColSyncMax:
+    return entry.syncMaxTime;
+  case ColMapRead:
+    return entry.mapReadSize;
+  case ColMapDirty:
+    return entry.mapDirtySize;
+  case ColCached:
+    return entry.cachedPercent;
+  case ColSpecialEvents:
+    return entry.specialEvents;
+  case ColProcess:
+    return entry.pid;
+  case ColLastThread:
+    return entry.lastThread;
+  case ColLastAccess:
+    return wallTime(entry.lastAccess);
+  default:
+    return 0;
+  }
+}
+
+void Aggregator::updateScale() {
+  std::lock_guard lck(mtxParams);
+  if (samplePeriod.count() && stats) {
+    double sampled = stats->sampledTime, elapsed = stats->elapsedTime;
+    scale = sampled ? elapsed / sampled
+                    : double(samplePeriod.count()) / sampleOn.count();
+  }
+}
+
+std::pair<Aggregator::Entry &, bool>
+Aggregator::getEntry(const std::string &path, pid_t pid) {
+  if (auto it = hashmap.find({pid, path}); it != hashmap.end())
+    return {*(it->second), false};
+  return {addEntry(path, pid), true};
+}
+
+std::pair<Aggregator::Entry &, bool>
+Aggregator::getEntry(const FileId &id, const std::string &path, pid_t pid) {
+  if (auto it = inodes.find({pid, id}); it != inodes.end())
+    return {*(it->second), false};
+  // Events by path only, e.g. a rename before the file was opened, are of
+  // the file at the path if its identity is not known.
+  Entry *entry;
+  bool inserted{false};
+  auto it = hashmap.find({pid, path});
+  if (it != hashmap.end() && !it->second->id.ino) {
+    entry = it->second;
+  } else {
+    entry = &addEntry(path, pid);
+    inserted = true;
+  }
+  entry->id = id;
+  inodes.emplace(InodeKey{pid, id}, entry);
+  return {*entry, inserted};
+}
+
+Aggregator::Entry &Aggregator::addEntry(const std::string &path, pid_t pid) {
+  auto &entry = list.emplace_back();
+  entry.path = path;
+  entry.pid = pid;
+  indexPath(entry);
+  return entry;
+}
+
+Aggregator::Entry *Aggregator::indexPath(Entry &entry) {
+  Entry *replaced{nullptr};
+  if (auto it = hashmap.find(entryKey(entry)); it != hashmap.end()) {
+    replaced = it->second;
+    hashmap.erase(it);
+  }
+  hashmap.emplace(entryKey(entry), &entry);
+  return replaced;
+}
+
+Aggregator::Entry *Aggregator::setPath(Entry &entry, const std::string &path) {
+  if (auto it = hashmap.find(entryKey(entry));
+      it != hashmap.end() && it->second == &entry)
+    hashmap.erase(it);
+  entry.path = path;
+  entry.filtered = filter->matches(path);
+  return indexPath(entry);
+}
+
+void Aggregator::eraseEntries(
+    const std::vector<std::list<Entry>::iterator> &entries, Entry &heir) {
+  std::unordered_set<const Entry *> erased;
+  for (auto it : entries)
+    erased.insert(&*it);
+  for (auto &[key, fd] : openFds) {
+    if (erased.count(fd.entry))
+      fd.entry = &heir;
+  }
+  for (auto it : entries) {
+    auto key = entryKey(*it);
+    if (auto e = hashmap.find(key); e != hashmap.end() && e->second == &*it)
+      hashmap.erase(e);
+    if (it->id.ino)
+      inodes.erase({key.first, it->id});
+    list.erase(it);
+  }
+}
+
+Aggregator::EntryKey Aggregator::entryKey(const Entry &entry) const {
+  bool split = splitPids && entry.path != evictedPath;
+  return {split ? entry.pid : 0, entry.path};
+}
+
+void Aggregator::mergeEntry(Entry &dst, const Entry &src) {
+  dst.openCount += src.openCount;
+  dst.closeCount += src.closeCount;
+  dst.readCount += src.readCount;
+  dst.writeCount += src.writeCount;
+  dst.readSize += src.readSize;
+  dst.writeSize += src.writeSize;
+  dst.syncCount += src.syncCount;
+  dst.syncTime += src.syncTime;
+  dst.syncMaxTime = std::max(dst.syncMaxTime, src.syncMaxTime);
+  dst.openNow += src.openNow;
+  dst.lifetimeCount += src.lifetimeCount;
+  dst.lifetime += src.lifetime;
+  dst.lifetimeMax = std::max(dst.lifetimeMax, src.lifetimeMax);
+  dst.unclosedCount += src.unclosedCount;
+  dst.mapReadSize += src.mapReadSize;
+  dst.mapDirtySize += src.mapDirtySize;
+  if (src.sizes) {
+    auto &d = sizes(dst);
+    for (size_t i = 0; i < sizeBuckets; ++i) {
+      d.read[i] += src.sizes->read[i];
+      d.write[i] += src.sizes->write[i];
+    }
+  }
+  if (src.callSites) {
+    if (!dst.callSites)
+      dst.callSites = std::make_unique<CallSites>();
+    for (const auto &[id, site] : *src.callSites) {
+      auto &d = (*dst.callSites)[id];
+      d.bytes += site.bytes;
+      d.ops += site.ops;
+    }
+  }
+}
+
+Aggregator::SizeHistograms &Aggregator::sizes(Entry &entry) {
+  if (!entry.sizes)
+    entry.sizes = std::make_unique<SizeHistograms>();
+  return *entry.sizes;
+}
+
+const Aggregator::SizeHistograms &
+Aggregator::sizes(const Entry &entry) {
+  static const SizeHistograms empty{};
+  return entry.sizes ? *entry.sizes : empty;
+}
+
+void Aggregator::trackOpen(Entry &entry, const EventInfo &info) {
+  if (info.fd < 0)
+    return;
+  uint64_t key = uint64_t(info.tgid) << 32 | uint32_t(info.fd);
+  uint64_t changes;
+  {
+    std::lock_guard lck(mtxParams);
+    changes = stats ? stats->degradationChanges.load() : 0;
+  }
+  OpenFd fd{&entry, info.time, changes};
+  auto [it, inserted] = openFds.try_emplace(key, fd);
+  if (!inserted) {
+    // The close was not seen: outside of a sampling window, or while only
+    // counters were reported.
+    if (it->second.entry->openNow)
+      --it->second.entry->openNow;
+    it->second = fd;
+  }
+  ++entry.openNow;
+}
+
+void Aggregator::trackClose(const EventInfo &info) {
+  uint64_t key = uint64_t(info.tgid) << 32 | uint32_t(info.fd);
+  auto it = info.fd < 0 ? openFds.end() : openFds.find(key);
+  if (it == openFds.end())
+    return;
+  // The file the fd was opened on, even if its path changed since.
+  Entry &entry = *it->second.entry;
+  uint64_t lifetime = info.time - it->second.openTime;
+  ++entry.lifetimeCount;
+  entry.lifetime += lifetime;
+  entry.lifetimeMax = std::max(entry.lifetimeMax, lifetime);
+  if (entry.openNow)
+    --entry.openNow;
+  openFds.erase(it);
+}
+
+void Aggregator::closeProcessFds(pid_t tgid) {
+  for (auto it = openFds.begin(); it != openFds.end();) {
+    if (pid_t(it->first >> 32) != tgid) {
+      ++it;
+      continue;
+    }
+    Entry &entry = *it->second.entry;
+    if (!closesMissed(it->second))
+      ++entry.unclosedCount;
+    if (entry.openNow)
+      --entry.openNow;
+    it = openFds.erase(it);
+  }
+}
+
+bool Aggregator::closesMissed(const OpenFd &fd) const {
+  std::lock_guard lck(mtxParams);
+  // Closes are not traced between sampling windows, nor reported while
+  // only counters are; such fds may have been closed.
+  if (samplePeriod.count())
+    return true;
+  if (!stats || stats->maxDegradation != Degradation::Counters)
+    return false;
+  return stats->degradation == Degradation::Counters ||
+         stats->degradationChanges != fd.degradationChanges;
+}
+
+void Aggregator::countCallSite(Entry &entry, const EventInfo &info) {
+  auto it = stackIds.find({info.tgid, info.stack});
+  if (it == stackIds.end()) {
+    if (stacks.size() >= maxStacks)
+      return;
+    it = stackIds.emplace(Stack{info.tgid, info.stack}, stacks.size()).first;
+    stacks.push_back(&it->first);
+    symbolizer->request(info.tgid, info.stack);
+  }
+  if (!entry.callSites)
+    entry.callSites = std::make_unique<CallSites>();
+  auto &site = (*entry.callSites)[it->second];
+  if (info.type == Event::Read || info.type == Event::Write)
+    site.bytes += info.sizeArg;
+  site.ops += info.count;
+}
+
+std::string Aggregator::fixRelativePath(const std::string &path) {
+  std::string s(path);
+  while (regex_search(s, reCurrent))
+    s = regex_replace(s, reCurrent, "/");
+  while (regex_search(s, reParent))
+    s = regex_replace(s, reParent, "/");
+  return s;
+}
+
+
+std::time_t Aggregator::wallTime(uint64_t monotonic) {
+  // Only shown rows are converted, so the offset is not cached; it follows
+  // wall clock adjustments.
+  timespec real, mono;
+  clock_gettime(CLOCK_REALTIME, &real);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  int64_t offset = (real.tv_sec - mono.tv_sec) * 1000000000ll +
+                   (real.tv_nsec - mono.tv_nsec);
+  return (static_cast<int64_t>(monotonic) + offset) / 1000000000;
+}
+
+size_t Aggregator::sizeBucket(size_t size) {
+  return std::min<size_t>(std::bit_width(size), sizeBuckets - 1);
+}
+
+size_t Aggregator::average(size_t total, size_t count) {
+  return count ? total / count : 0;
+}
+
+size_t Aggregator::estimate(size_t value) const { return value * scale + 0.5; }
+
+size_t Aggregator::smallOpsPercent(const Entry &entry) {
+  size_t count = entry.writeCount + entry.readCount;
+  if (!count)
+    return 0;
+  size_t small{0};
+  const auto &hist = sizes(entry);
+  for (size_t i = 0; i < smallSizeBuckets; ++i)
+    small += hist.write[i] + hist.read[i];
+  return small * 100 / count;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "column.hpp"
+#include "event.hpp"
+#include "filter.hpp"
+#include "snapshot.hpp"
+#include "symbolizer.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Per-file statistics of the traced events. Output renders them; programs
+// linking libpsfiles pull them as snapshots.
+class Aggregator {
+public:
+  Aggregator(std::shared_ptr<const Filter> filter);
+  Aggregator(const Aggregator &) = delete;
+  Aggregator &operator=(const Aggregator &) = delete;
+  virtual ~Aggregator();
+  void setSplitPids(bool split);
+  void setStats(std::shared_ptr<const TracerStats> stats);
+  void setSampling(std::chrono::milliseconds on,
+                   std::chrono::milliseconds period);
+  // Names the call sites of events with stacks.
+  void setSymbolizer(std::shared_ptr<Symbolizer> symbolizer);
+  // Keeps statistics for at most count files, zero for no limit; least
+  // recently used files are merged into the *EVICTED* entry, which counts
+  // against the limit.
+  void setMaxEntries(size_t count);
+  // Replaces the last published snapshot with the current statistics.
+  void publish();
+  // Last published snapshot: every column of the files passing the filter,
+  // with split processes merged. It is shared, not copied, and stays valid
+  // while held.
+  std::shared_ptr<const Snapshot> snapshot() const;
+
+protected:
+  // Bucket 0 counts zero-sized operations, bucket N counts operations
+  // of [2^(N-1), 2^N) bytes, the last one counts everything larger.
+  static constexpr size_t sizeBuckets{22};
+  static constexpr size_t smallSizeBuckets{13};
+  using SizeHistogram = std::array<uint32_t, sizeBuckets>;
+  struct SizeHistograms {
+    SizeHistogram write{};
+    SizeHistogram read{};
+  };
+  struct CallSite {
+    size_t bytes{0};
+    size_t ops{0};
+  };
+  // Keyed by stack id.
+  using CallSites = std::unordered_map<uint32_t, CallSite>;
+  struct Entry {
+    enum {
+      EventMapped = (1 << 0),
+      EventUnlinked = (1 << 1),
+      EventRenamed = (1 << 2)
+    };
+    // Display name; events are accounted by identity when it is known, so
+    // the path follows renames.
+    std::string path;
+    FileId id{};
+    size_t writeSize{0};
+    size_t readSize{0};
+    size_t writeCount{0};
+    size_t readCount{0};
+    size_t openCount{0};
+    size_t closeCount{0};
+    size_t syncCount{0};
+    uint64_t syncTime{0};
+    uint64_t syncMaxTime{0};
+    // Lifetime of fds whose open and close were both seen, fds open now
+    // and fds still open when their process exited.
+    size_t openNow{0};
+    size_t lifetimeCount{0};
+    uint64_t lifetime{0};
+    uint64_t lifetimeMax{0};
+    size_t unclosedCount{0};
+    // Estimated by the map sampler from the growth of resident and dirty
+    // pages of mappings.
+    size_t mapReadSize{0};
+    size_t mapDirtySize{0};
+    // Allocated on the first read or write only.
+    std::unique_ptr<SizeHistograms> sizes;
+    // Allocated on the first event with a stack only.
+    std::unique_ptr<CallSites> callSites;
+    // CLOCK_MONOTONIC nanoseconds, converted to wall time when shown.
+    uint64_t lastAccess{0};
+    // Process of the last access; constant when stats are split by process.
+    pid_t pid{0};
+    pid_t lastThread{0};
+    uint8_t specialEvents{0};
+    bool filtered{false};
+    // Page cache residency, negative until measured.
+    int8_t cachedPercent{-1};
+  };
+  // Process id is zero unless stats are split by process.
+  using EntryKey = std::pair<pid_t, std::string_view>;
+  struct EntryKeyHash {
+    size_t operator()(const EntryKey &key) const {
+      return std::hash<std::string_view>()(key.second) ^ key.first;
+    }
+  };
+  using InodeKey = std::pair<pid_t, FileId>;
+  struct InodeKeyHash {
+    size_t operator()(const InodeKey &key) const {
+      return std::hash<uint64_t>()(key.second.ino) ^ key.second.dev ^
+             key.first;
+    }
+  };
+  using Stack = std::pair<pid_t, std::vector<uint64_t>>;
+  struct OpenFd {
+    Entry *entry;
+    uint64_t openTime;
+    // Degradation changes of the tracer when the fd was opened.
+    uint64_t degradationChanges;
+  };
+  static constexpr size_t maxStacks{65536};
+  static constexpr const char *evictedPath{"*EVICTED*"};
+  static constexpr size_t eventTypes{std::size(eventNames)};
+  const std::regex reCurrent{R"(/\./)"};
+  const std::regex reParent{R"(/[^\./]+/\.\./)"};
+  bool splitPids{false};
+  std::shared_ptr<const Filter> filter;
+  std::shared_ptr<const TracerStats> stats;
+  std::chrono::milliseconds sampleOn{0}, samplePeriod{0};
+  // Inverse of the observed sampling duty cycle, applied to counters.
+  double scale{1};
+  std::set<pid_t> processes;
+  size_t maxEntries{0}, evictedCount{0};
+  std::array<size_t, eventTypes> eventCounts{};
+  std::list<Entry> list;
+  // Keys point to the paths stored in the list entries. Files replaced at
+  // a path, e.g. by a rename over them, are left out.
+  std::unordered_map<EntryKey, Entry *, EntryKeyHash> hashmap;
+  // Entries of files with a known identity.
+  std::unordered_map<InodeKey, Entry *, InodeKeyHash> inodes;
+  // Files mapped by each process, watched by the map sampler.
+  std::set<std::pair<pid_t, std::string>> mappedFiles;
+  // Fds of each (process, fd) pair opened while traced and not closed yet.
+  std::unordered_map<uint64_t, OpenFd> openFds;
+  // Distinct stacks of each process, numbered in order of appearance;
+  // events with new stacks are not attributed once maxStacks are known.
+  std::map<Stack, uint32_t> stackIds;
+  std::vector<const Stack *> stacks;
+  std::shared_ptr<Symbolizer> symbolizer;
+  std::shared_ptr<const Snapshot> published;
+  mutable std::mutex mtxParams, mtxPublished;
+  // Accounts one event to its file, which is returned; events without one
+  // return null.
+  Entry *process(EventInfo &event);
+  std::pair<Entry &, bool> getEntry(const std::string &path, pid_t pid = 0);
+  std::pair<Entry &, bool> getEntry(const FileId &id, const std::string &path,
+                                    pid_t pid);
+  EntryKey entryKey(const Entry &entry) const;
+  // Renames an entry, returning the one of another file previously at the
+  // path, if any.
+  Entry *setPath(Entry &entry, const std::string &path);
+  // Removes entries; their open fds are accounted to heir.
+  void eraseEntries(const std::vector<std::list<Entry>::iterator> &entries,
+                    Entry &heir);
+  // Evicts entries beyond maxEntries.
+  void evictEntries();
+  // Called with the entries being evicted, before they are merged into
+  // evicted and removed.
+  virtual void onEvict(const std::unordered_set<const Entry *> &victims,
+                       Entry &evicted);
+  Snapshot makeSnapshot();
+  int64_t columnValue(const Entry &entry, Column column) const;
+  void updateScale();
+  size_t estimate(size_t value) const;
+  static void mergeEntry(Entry &dst, const Entry &src);
+  static SizeHistograms &sizes(Entry &entry);
+  static const SizeHistograms &sizes(const Entry &entry);
+  static std::time_t wallTime(uint64_t monotonic);
+  static size_t sizeBucket(size_t size);
+  static size_t average(size_t total, size_t count);
+  static size_t smallOpsPercent(const Entry &entry);
+
+private:
+  Entry &addEntry(const std::string &path, pid_t pid);
+  // Indexes an entry by its path, returning the one of another file
+  // previously at the path, if any.
+  Entry *indexPath(Entry &entry);
+  void trackOpen(Entry &entry, const EventInfo &info);
+  void trackClose(const EventInfo &info);
+  void closeProcessFds(pid_t tgid);
+  bool closesMissed(const OpenFd &fd) const;
+  void countCallSite(Entry &entry, const EventInfo &info);
+  std::string fixRelativePath(const std::string &path);
+};
@@ -10,9 +10,18 @@
 #include <iostream>
 #include <iterator>
 #include <numeric>
+#include <optional>
+#include <string_view>
 #include <sys/types.h>
 #include <unistd.h>
 
+static std::optional<Column> columnByName(std::string_view name) {
+  auto beg = std::cbegin(columnNames), end = std::cend(columnNames);
+  if (auto it = std::find(beg, end, name); it != end)
+    return static_cast<Column>(std::distance(beg, it));
+  return std::nullopt;
+}
+
 ArgsParser::ArgsParser(int argc, char **argv) : exe(argv[0]) {
   if (!(success = parse(argc, argv)))
     printUsage();
@@ -22,13 +31,19 @@ bool ArgsParser::parse(int argc, char **argv) {
   std::array<option, argsList.size() + 1> longOpts{};
   std::transform(
       argsList.cbegin(), argsList.cend(), longOpts.begin(), [](const Arg &arg) {
-        return option{arg.longName, required_argument, 0, arg.shortName};
+        return option{arg.longName,
+                      arg.argName ? required_argument : no_argument, 0,
+                      arg.shortName};
       });
   std::string shortOpts =
       std::accumulate(argsList.cbegin(), argsList.cend(), std::string(),
                       [](const std::string &acc, const Arg &arg) {
-                        return acc + arg.shortName + ':';
+                        return acc + arg.shortName + (arg.argName ? ":" : "");
                       });
+  // psfiles diff [OPTION]... BEFORE AFTER
+  bool diff = argc > 1 && strcmp(argv[1], "diff") == 0;
+  if (diff)
+    optind = 2;
   int opt;
   while ((opt = getopt_long(argc, argv, shortOpts.data(), longOpts.data(),
                             0)) != -1) {
@@ -37,43 +52,152 @@ bool ArgsParser::parse(int argc, char **argv) {
       mOutputFile = optarg;
       break;
     }
+    case 'l': {
+      mLogFile = optarg;
+      break;
+    }
+    case 'x': {
+      mSnapshotFile = optarg;
+      break;
+    }
+    case 'T': {
+      mTimelineFile = optarg;
+      break;
+    }
+    case 'L': {
+      const char *first = optarg, *last = optarg + strlen(optarg);
+      auto [ptr, ec] = std::from_chars(first, last, mTimelineMin);
+      // Converted to nanoseconds, which must fit in 64 bits.
+      if (!(ec == std::errc() && ptr == last && mTimelineMin >= 0 &&
+            mTimelineMin <= maxTimelineMin)) {
+        LOGE("Invalid --timeline-min option: must be a non-negative "
+             "number up to 1e15.");
+        return false;
+      }
+      break;
+    }
     case 's': {
       if (std::string s = optarg; !s.empty()) {
         if (s.back() == '-') {
           s.pop_back();
           mReverseSorting = true;
         }
-        auto beg = std::cbegin(columnNames), end = std::cend(columnNames);
-        if (auto it = std::find(beg, end, s); it != end) {
-          mSortType = static_cast<Column>(std::distance(beg, it));
+        if (auto col = columnByName(s)) {
+          mSortType = *col;
           break;
         }
       }
       LOGE("Unknown column name: #.", optarg);
       return false;
     }
+    case 'C': {
+      mColumns = {ColPath};
+      std::string_view list = optarg;
+      while (!list.empty()) {
+        auto name = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(name.size() + 1, list.size()));
+        auto col = columnByName(name);
+        if (!col) {
+          LOGE("Unknown column name: #.", name);
+          return false;
+        }
+        if (std::find(mColumns.cbegin(), mColumns.cend(), *col) ==
+            mColumns.cend())
+          mColumns.push_back(*col);
+      }
+      break;
+    }
     case 'd': {
       const char *first = optarg, *last = optarg + strlen(optarg);
       auto [ptr, ec] = std::from_chars(first, last, mDelay);
-      if (!(ec == std::errc() && ptr == last && mDelay)) {
-        LOGE("Invalid --delay option: must be a positive integer.");
+      if (!(ec == std::errc() && ptr == last && mDelay > 0 &&
+            mDelay <= maxSeconds)) {
+        LOGE("Invalid --delay option: must be a positive number up to 1e9.");
+        return false;
+      }
+      mDelay = std::max(mDelay, minDelay);
+      break;
+    }
+    case 'm': {
+      const char *first = optarg, *last = optarg + strlen(optarg);
+      auto [ptr, ec] = std::from_chars(first, last, mMaxEntries);
+      if (!(ec == std::errc() && ptr == last && mMaxEntries)) {
+        LOGE("Invalid --max-entries option: must be a positive integer.");
+        return false;
+      }
+      break;
+    }
+    case 'S': {
+      const char *first = optarg, *last = optarg + strlen(optarg);
+      unsigned on{0}, period{0};
+      auto r = std::from_chars(first, last, on);
+      if (r.ec == std::errc() && r.ptr != last && *r.ptr == '/')
+        r = std::from_chars(r.ptr + 1, last, period);
+      if (!(r.ec == std::errc() && r.ptr == last && on && on < period)) {
+        LOGE("Invalid --sample option: must be ON/PERIOD milliseconds with "
+             "0 < ON < PERIOD.");
+        return false;
+      }
+      mSampleOn = std::chrono::milliseconds(on);
+      mSamplePeriod = std::chrono::milliseconds(period);
+      break;
+    }
+    case 'D': {
+      const char *first = optarg, *last = optarg + strlen(optarg);
+      auto [ptr, ec] = std::from_chars(first, last, mDuration);
+      if (!(ec == std::errc() && ptr == last && mDuration > 0 &&
+            mDuration <= maxSeconds)) {
+        LOGE("Invalid --duration option: must be a positive number up to "
+             "1e9.");
+        return false;
+      }
+      break;
+    }
+    case 'r': {
+      if (strcmp(optarg, "table") && strcmp(optarg, "json")) {
+        LOGE("Invalid --report option: must be table or json.");
+        return false;
+      }
+      mReport = optarg;
+      break;
+    }
+    case 'n': {
+      const char *first = optarg, *last = optarg + strlen(optarg);
+      auto [ptr, ec] = std::from_chars(first, last, mTop);
+      if (!(ec == std::errc() && ptr == last && mTop)) {
+        LOGE("Invalid --top option: must be a positive integer.");
         return false;
       }
       break;
     }
     case 'f': {
-      mFilter = optarg;
+      mFilters.push_back(optarg);
       break;
     }
     case 'p': {
       const char *first = optarg, *last = optarg + strlen(optarg);
-      auto [ptr, ec] = std::from_chars(first, last, mTraceePid);
-      if (!(ec == std::errc() && ptr == last && mTraceePid > 0 &&
-            mTraceePid != getpid())) {
+      pid_t pid;
+      auto [ptr, ec] = std::from_chars(first, last, pid);
+      if (!(ec == std::errc() && ptr == last && pid > 0 && pid != getpid())) {
         LOGE("Invalid --pid option: must be a positive integer not equal "
              "to current pid.");
         return false;
       }
+      if (std::find(mTraceePids.cbegin(), mTraceePids.cend(), pid) ==
+          mTraceePids.cend())
+        mTraceePids.push_back(pid);
+      break;
+    }
+    case 'g': {
+      mCgroup = optarg;
+      break;
+    }
+    case 'P': {
+      mSplitPids = true;
+      break;
+    }
+    case 'k': {
+      mStacks = true;
       break;
     }
     case 'c': {
@@ -86,15 +210,32 @@ bool ArgsParser::parse(int argc, char **argv) {
     }
   }
 final_check:
-  if (static_cast<bool>(mTraceePid) == static_cast<bool>(mTraceeArgs)) {
-    LOGE(
-        "One and only one of --pid and --cmdline options should be specified.");
+  if (diff) {
+    if (mTraceeArgs || !mTraceePids.empty() || mCgroup ||
+        argc - optind != 2) {
+      LOGE("diff takes two snapshot files and no tracee.");
+      return false;
+    }
+    mDiffFiles = {argv[optind], argv[optind + 1]};
+    return true;
+  }
+  if ((!mTraceePids.empty() || mCgroup) == static_cast<bool>(mTraceeArgs)) {
+    LOGE("One and only one of --pid/--cgroup and --cmdline options should be "
+         "specified.");
     return false;
   }
   return true;
 }
 
-pid_t ArgsParser::traceePid() const { return mTraceePid; }
+const std::vector<pid_t> &ArgsParser::traceePids() const {
+  return mTraceePids;
+}
+
+const char *ArgsParser::cgroup() const { return mCgroup; }
+
+bool ArgsParser::splitPids() const { return mSplitPids; }
+
+bool ArgsParser::stacks() const { return mStacks; }
 
 char *const *ArgsParser::traceeArgs() const { return mTraceeArgs; }
 
@@ -102,22 +243,62 @@ Column ArgsParser::sortType() const { return mSortType; }
 
 bool ArgsParser::reverseSorting() const { return mReverseSorting; }
 
-unsigned ArgsParser::delay() const { return mDelay; }
+double ArgsParser::delay() const { return mDelay; }
+
+size_t ArgsParser::maxEntries() const { return mMaxEntries; }
+
+std::chrono::milliseconds ArgsParser::sampleOn() const { return mSampleOn; }
+
+std::chrono::milliseconds ArgsParser::samplePeriod() const {
+  return mSamplePeriod;
+}
+
+double ArgsParser::duration() const { return mDuration; }
+
+const char *ArgsParser::report() const {
+  // A timed run implies a report.
+  if (!mReport && mDuration)
+    return "table";
+  return mReport;
+}
+
+size_t ArgsParser::top() const { return mTop; }
 
 const char *ArgsParser::outputFile() const { return mOutputFile; }
 
-const char *ArgsParser::filter() const { return mFilter; }
+const char *ArgsParser::logFile() const { return mLogFile; }
+
+const char *ArgsParser::snapshotFile() const { return mSnapshotFile; }
+
+const char *ArgsParser::timelineFile() const { return mTimelineFile; }
+
+uint64_t ArgsParser::timelineMin() const { return mTimelineMin * 1000; }
+
+bool ArgsParser::diffMode() const { return mDiffFiles[0]; }
+
+const std::array<const char *, 2> &ArgsParser::diffFiles() const {
+  return mDiffFiles;
+}
+
+const std::vector<std::string> &ArgsParser::filters() const {
+  return mFilters;
+}
+
+const std::vector<Column> &ArgsParser::columns() const { return mColumns; }
 
 ArgsParser::operator bool() const { return success; }
 
 void ArgsParser::printUsage() const {
   auto print = [](const Arg &arg) {
-    std::string left = std::string("-") + arg.shortName + ", " + arg.longName +
-                       " " + arg.argName;
+    std::string left = std::string("-") + arg.shortName + ", " + arg.longName;
+    if (arg.argName)
+      left += std::string(" ") + arg.argName;
     std::cout << std::left << std::setw(25) << left << arg.description
               << std::endl;
   };
-  std::cout << "Usage:\n" << exe << " [-osdf] -p | -c\n";
+  std::cout << "Usage:\n"
+            << exe << " [-osCdmSDrnxTLfPkl] -p... | -g | -c\n"
+            << exe << " diff [-Cn] BEFORE AFTER\n";
   std::for_each(argsList.cbegin(), argsList.cend(), print);
   std::cout << "Column names: ";
   std::copy(std::cbegin(columnNames), std::cend(columnNames),
@@ -2,7 +2,11 @@
 
 #include "column.hpp"
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
 #include <sys/types.h>
+#include <vector>
 
 class ArgsParser {
 private:
@@ -10,33 +14,85 @@ private:
     char shortName;
     const char *longName, *argName, *description;
   };
-  static constexpr std::array<Arg, 6> argsList{
+  // Options with a null argName take no argument.
+  static constexpr std::array<Arg, 19> argsList{
       {{'o', "output", "FILE", "output to FILE instead of stdout"},
        {'s', "sort", "COLUMN", "sort output by COLUMN"},
-       {'f', "filter", "GLOB", "filter filepaths with GLOB"},
+       {'C', "columns", "LIST", "show comma-separated COLUMNS only"},
+       {'f', "filter", "PATTERN", "filter filepaths with PATTERN"},
        {'d', "delay", "SECONDS", "interval between list updates"},
+       {'m', "max-entries", "N", "keep at most N files, evict cold ones"},
+       {'S', "sample", "ON/PERIOD", "trace ON of every PERIOD milliseconds"},
+       {'D', "duration", "SECONDS", "trace for SECONDS, then print report"},
+       {'r', "report", "FORMAT", "print table or json report at the end"},
+       {'n', "top", "N", "show N files per column in the report"},
+       {'x', "snapshot", "FILE", "save final statistics to FILE for diff"},
+       {'T', "timeline", "FILE", "write syscalls to FILE as a Chrome trace"},
+       {'L', "timeline-min", "USECS", "omit syscalls shorter than USECS"},
        {'p', "pid", "PID", "attach to existing process with id PID"},
+       {'g', "cgroup", "PATH", "attach to all processes in cgroup PATH"},
+       {'P', "split-pids", nullptr, "keep separate stats for each process"},
+       {'k', "stacks", nullptr, "show the call sites of file I/O"},
+       {'l', "log", "FILE", "write log messages to FILE instead of stderr"},
        {'c', "cmdline", "CMDLINE", "spawn new process with CMDLINE"}}};
   const char *exe;
   bool success;
-  pid_t mTraceePid{0};
+  std::vector<pid_t> mTraceePids;
+  const char *mCgroup{nullptr};
+  bool mSplitPids{false};
+  bool mStacks{false};
   Column mSortType{ColPath};
   bool mReverseSorting{false};
-  unsigned mDelay{1};
+  // Shorter intervals are raised to minDelay seconds; longer ones than
+  // maxSeconds would overflow the clocks they are added to.
+  static constexpr double minDelay{0.05};
+  static constexpr double maxSeconds{1e9};
+  static constexpr double maxTimelineMin{1e15};
+  double mDelay{1};
+  size_t mMaxEntries{0};
+  std::chrono::milliseconds mSampleOn{0}, mSamplePeriod{0};
+  double mDuration{0};
+  const char *mReport{nullptr};
+  size_t mTop{10};
   char *const *mTraceeArgs{nullptr};
   const char *mOutputFile{nullptr};
-  const char *mFilter{"*"};
+  const char *mLogFile{nullptr};
+  const char *mSnapshotFile{nullptr};
+  const char *mTimelineFile{nullptr};
+  double mTimelineMin{0};
+  // Snapshots compared in diff mode.
+  std::array<const char *, 2> mDiffFiles{};
+  std::vector<std::string> mFilters;
+  std::vector<Column> mColumns{std::cbegin(defaultColumns),
+                               std::cend(defaultColumns)};
   bool parse(int argc, char **argv);
   void printUsage() const;
 
 public:
   ArgsParser(int argc, char **argv);
-  pid_t traceePid() const;
+  const std::vector<pid_t> &traceePids() const;
+  const char *cgroup() const;
+  bool splitPids() const;
+  bool stacks() const;
   Column sortType() const;
   bool reverseSorting() const;
-  unsigned delay() const;
+  double delay() const;
+  size_t maxEntries() const;
+  std::chrono::milliseconds sampleOn() const;
+  std::chrono::milliseconds samplePeriod() const;
+  double duration() const;
+  const char *report() const;
+  size_t top() const;
   char *const *traceeArgs() const;
   const char *outputFile() const;
-  const char *filter() const;
+  const char *logFile() const;
+  const char *snapshotFile() const;
+  const char *timelineFile() const;
+  // Nanoseconds.
+  uint64_t timelineMin() const;
+  bool diffMode() const;
+  const std::array<const char *, 2> &diffFiles() const;
+  const std::vector<std::string> &filters() const;
+  const std::vector<Column> &columns() const;
   operator bool() const;
 };
@@ -0,0 +1,150 @@
+#include "cachesampler.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Linux 6.5, not yet in every libc's headers.
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+namespace {
+struct CachestatRange {
+  uint64_t off;
+  uint64_t len;
+};
+struct Cachestat {
+  uint64_t nrCache;
+  uint64_t nrDirty;
+  uint64_t nrWriteback;
+  uint64_t nrEvicted;
+  uint64_t nrRecentlyEvicted;
+};
+} // namespace
+
+CacheSampler::CacheSampler(std::chrono::duration<double> interval)
+    : interval(interval) {
+  thread = std::thread(&CacheSampler::threadRoutine, this);
+}
+
+CacheSampler::~CacheSampler() {
+  {
+    std::lock_guard lck(mtx);
+    stopReq = true;
+  }
+  cv.notify_one();
+  thread.join();
+}
+
+void CacheSampler::watch(std::vector<std::string> p) {
+  std::lock_guard lck(mtx);
+  paths = std::move(p);
+}
+
+std::unordered_map<std::string, int> CacheSampler::results() const {
+  std::lock_guard lck(mtx);
+  return percents;
+}
+
+void CacheSampler::threadRoutine() {
+  std::unique_lock lck(mtx);
+  while (!stopReq) {
+    cv.wait_for(lck, interval, [this] { return stopReq; });
+    if (stopReq)
+      break;
+    auto p = paths;
+    lck.unlock();
+    sample(p);
+    lck.lock();
+  }
+}
+
+void CacheSampler::sample(const std::vector<std::string> &p) {
+  std::erase_if(scans, [&](const auto &s) {
+    return std::find(p.cbegin(), p.cend(), s.first) == p.cend();
+  });
+  std::unordered_map<std::string, int> res;
+  // The round starts where the previous one ran out of budget.
+  uint64_t budget = bytesPerRound;
+  for (size_t i = 0; i < p.size(); ++i) {
+    size_t idx = (nextPath + i) % p.size();
+    auto &s = scans[p[idx]];
+    if (budget) {
+      budget -= std::min(budget, scan(p[idx], s, budget));
+      if (!budget)
+        nextPath = idx + 1;
+    }
+    if (s.percent >= 0)
+      res.emplace(p[idx], s.percent);
+  }
+  std::lock_guard lck(mtx);
+  percents = std::move(res);
+}
+
+uint64_t CacheSampler::scan(const std::string &path, Scan &s,
+                            uint64_t budget) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+  if (fd == -1 && errno == EPERM)
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+  struct stat st;
+  uint64_t used{0};
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if (!useCachestat || !cachestat(fd, st.st_size, s))
+      used = mincore(fd, st.st_size, s, budget);
+  }
+  close(fd);
+  return used;
+}
+
+bool CacheSampler::cachestat(int fd, uint64_t size, Scan &s) {
+  CachestatRange range{0, 0};
+  Cachestat cs{};
+  if (syscall(__NR_cachestat, fd, &range, &cs, 0) == -1) {
+    if (errno == ENOSYS)
+      useCachestat = false;
+    return false;
+  }
+  uint64_t pages = (size + getpagesize() - 1) / getpagesize();
+  s.percent = pages ? std::min<uint64_t>(cs.nrCache * 100 / pages, 100) : 100;
+  return true;
+}
+
+uint64_t CacheSampler::mincore(int fd, uint64_t size, Scan &s,
+                               uint64_t budget) {
+  const uint64_t page = getpagesize();
+  if (size == 0) {
+    s = {0, 0, 0, 100};
+    return 0;
+  }
+  if (s.offset >= size)
+    s.offset = s.cachedPages = s.totalPages = 0;
+  uint64_t used{0};
+  std::vector<unsigned char> vec;
+  while (s.offset < size && used < budget) {
+    // Offsets of the next windows must stay page aligned, only the final
+    // window ends at the file size.
+    uint64_t len = std::min(windowSize, budget - used) / page * page;
+    len = std::min(std::max(len, page), size - s.offset);
+    void *addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, s.offset);
+    if (addr == MAP_FAILED)
+      return used;
+    vec.resize((len + page - 1) / page);
+    if (::mincore(addr, len, vec.data()) == 0) {
+      s.cachedPages += std::count_if(vec.cbegin(), vec.cend(),
+                                     [](unsigned char c) { return c & 1; });
+      s.totalPages += vec.size();
+    }
+    munmap(addr, len);
+    s.offset += len;
+    used += len;
+  }
+  if (s.offset >= size && s.totalPages)
+    s.percent = s.cachedPages * 100 / s.totalPages;
+  return used;
+}
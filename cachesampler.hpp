@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Measures which part of the watched files is resident in the page cache,
+// with cachestat(2) where the kernel has it, otherwise with mincore(2) on
+// a read-only mapping. Neither reads the file. Files are scanned in
+// windows, at most bytesPerRound per interval, so that multi-gigabyte
+// files are measured over several rounds.
+class CacheSampler {
+public:
+  CacheSampler(std::chrono::duration<double> interval);
+  CacheSampler(const CacheSampler &) = delete;
+  CacheSampler &operator=(const CacheSampler &) = delete;
+  ~CacheSampler();
+  void watch(std::vector<std::string> paths);
+  // Cached percentage of the watched files measured completely so far.
+  std::unordered_map<std::string, int> results() const;
+
+private:
+  struct Scan {
+    uint64_t offset{0};
+    uint64_t cachedPages{0};
+    uint64_t totalPages{0};
+    int percent{-1};
+  };
+  static constexpr uint64_t bytesPerRound{1ull << 30};
+  static constexpr uint64_t windowSize{256ull << 20};
+  std::chrono::duration<double> interval;
+  bool useCachestat{true};
+  size_t nextPath{0};
+  // Sampler thread state.
+  std::unordered_map<std::string, Scan> scans;
+  // Shared state.
+  std::vector<std::string> paths;
+  std::unordered_map<std::string, int> percents;
+  bool stopReq{false};
+  mutable std::mutex mtx;
+  std::condition_variable cv;
+  std::thread thread;
+  void threadRoutine();
+  void sample(const std::vector<std::string> &paths);
+  uint64_t scan(const std::string &path, Scan &scan, uint64_t budget);
+  bool cachestat(int fd, uint64_t size, Scan &scan);
+  uint64_t mincore(int fd, uint64_t size, Scan &scan, uint64_t budget);
+};
@@ -8,14 +8,49 @@ enum Column {
   ColReadSize,
   ColWriteCount,
   ColReadCount,
+  ColWriteAvg,
+  ColReadAvg,
+  ColSmallOps,
   ColOpenCount,
   ColCloseCount,
+  ColOpenNow,
+  ColOpenAvg,
+  ColOpenMax,
+  ColUnclosed,
+  ColSyncCount,
+  ColSyncTime,
+  ColSyncMax,
+  ColMapRead,
+  ColMapDirty,
+  ColCached,
   ColSpecialEvents,
+  ColProcess,
   ColLastThread,
   ColLastAccess,
   ColumnsCount
 };
 
 static constexpr const char *columnNames[]{
-    "path",   "wsize",  "rsize", "wcount",  "rcount",
-    "ocount", "ccount", "spec",  "lthread", "laccess"};
+    "path",   "wsize",   "rsize",   "wcount",   "rcount",  "wavg",
+    "ravg",   "small%",  "ocount",  "ccount",   "onow",    "oavg",
+    "omax",   "unclosed", "scount", "stime",    "smax",    "mread",
+    "mdirty", "cached%", "spec",    "pid",      "lthread", "laccess"};
+
+static constexpr Column defaultColumns[]{
+    ColPath,       ColWriteSize, ColReadSize,   ColWriteCount,
+    ColReadCount,  ColOpenCount, ColCloseCount, ColSpecialEvents,
+    ColLastThread, ColLastAccess};
+
+// Columns with a value to rank files by.
+constexpr bool isMetric(Column column) {
+  switch (column) {
+  case ColPath:
+  case ColSpecialEvents:
+  case ColProcess:
+  case ColLastThread:
+  case ColLastAccess:
+    return false;
+  default:
+    return true;
+  }
+}
@@ -1,19 +1,95 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iterator>
 #include <string>
 #include <sys/types.h>
+#include <vector>
 
-enum class Event { Open, Close, Read, Write, Map, Rename, Unlink };
+// Exit is the end of a process, not a syscall, and is not counted.
+enum class Event {
+  Open,
+  Close,
+  Read,
+  Write,
+  Map,
+  Rename,
+  Unlink,
+  Sync,
+  Exit
+};
+
+static constexpr const char *eventNames[]{"open", "close",  "read",   "write",
+                                          "map",  "rename", "unlink", "sync"};
+
+// Device and inode of a file, zero if unknown. Inode numbers are reused
+// once files are gone; the inode generation, where the filesystem keeps
+// one, tells the new files apart.
+struct FileId {
+  uint64_t dev{0};
+  uint64_t ino{0};
+  uint32_t generation{0};
+  bool operator==(const FileId &) const = default;
+};
 
 struct EventInfo {
+  // Thread id; tgid is the id of its process.
   pid_t pid;
   Event type;
   std::string path;
   bool exists{true};
   size_t sizeArg{0};
   std::string strArg{};
+  // Nanoseconds from the syscall entry to its exit.
+  uint64_t duration{0};
+  pid_t tgid{0};
+  // CLOCK_MONOTONIC time of the syscall exit in nanoseconds.
+  uint64_t time{0};
+  // Number of reads or writes merged into the event while coalescing.
+  size_t count{1};
+  // Descriptor opened or closed.
+  int fd{-1};
+  // Code addresses at the syscall entry, innermost first, if stacks are
+  // captured.
+  std::vector<uint64_t> stack{};
+  // Events with the same identity are of the same file, whatever its path.
+  FileId id{};
+};
+
+// Steps taken while the output falls behind, each one keeping the previous
+// ones: consecutive reads or writes of a thread on the same file are merged
+// into one event, events get the time of the last tick instead of their own,
+// paths are only resolved for fds seen before, events are only counted.
+enum class Degradation { None, Coalesce, NoTimestamps, HotFdsOnly, Counters };
+
+static constexpr const char *degradationNames[]{
+    "none", "coalescing events", "no timestamps", "hot fds only",
+    "counters only"};
+
+// Tracer counters read by the output, in nanoseconds.
+struct TracerStats {
+  // Time since tracing started and the part of it spent in sampling windows.
+  std::atomic<uint64_t> elapsedTime{0};
+  std::atomic<uint64_t> sampledTime{0};
+  // Tracer thread CPU time, set when tracing ends.
+  std::atomic<uint64_t> cpuTime{0};
+  std::atomic<uint64_t> syscallStops{0};
+  std::atomic<uint64_t> events{0};
+  // CLOCK_BOOTTIME of the attach, zero if the tracee was spawned: threads
+  // started before it were partly not traced.
+  std::atomic<uint64_t> attachTime{0};
+  std::atomic<Degradation> degradation{Degradation::None};
+  std::atomic<Degradation> maxDegradation{Degradation::None};
+  std::atomic<uint64_t> degradationChanges{0};
+  // Events counted but not passed to the output, by type, in counters-only
+  // mode.
+  std::array<std::atomic<uint64_t>, std::size(eventNames)> unlistedEvents{};
+  std::atomic<uint64_t> unlistedReadSize{0};
+  std::atomic<uint64_t> unlistedWriteSize{0};
 };
 
 using EventCallback = std::function<void(const EventInfo &)>;
@@ -0,0 +1,101 @@
+#include "filter.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <fnmatch.h>
+#include <iterator>
+#include <sstream>
+
+Filter::Filter(const std::vector<std::string> &patterns) : patterns(patterns) {
+  for (const auto &p : patterns) {
+    std::string_view s = p;
+    bool exclude = s.starts_with('!');
+    if (exclude)
+      s.remove_prefix(1);
+    hasIncludes |= !exclude;
+    hasExcludes |= exclude;
+    if (s.starts_with('~')) {
+      s.remove_prefix(1);
+      try {
+        regexes.emplace_back(std::regex(s.cbegin(), s.cend()), exclude);
+      } catch (const std::regex_error &e) {
+        LOGE("Invalid regular expression #: #.", s, e.what());
+        success = false;
+      }
+    } else {
+      addGlob(std::string(s), exclude);
+    }
+  }
+}
+
+void Filter::addGlob(const std::string &glob, bool exclude) {
+  // Literal prefix of the glob goes to the trie, the rest is left to fnmatch.
+  size_t len = glob.find_first_of("*?[\\");
+  if (len == std::string::npos)
+    len = glob.size();
+  uint32_t node{0};
+  for (size_t i = 0; i < len; ++i) {
+    auto &children = trie[node].children;
+    auto it = std::find_if(children.cbegin(), children.cend(),
+                           [c = glob[i]](const auto &p) { return p.first == c; });
+    if (it != children.cend()) {
+      node = it->second;
+    } else {
+      children.emplace_back(glob[i], trie.size());
+      node = trie.size();
+      trie.emplace_back();
+    }
+  }
+  trie[node].globs.push_back(globs.size());
+  globs.push_back({glob.substr(len), exclude});
+}
+
+std::vector<std::string> Filter::split(const std::string &spec) {
+  std::istringstream s(spec);
+  return {std::istream_iterator<std::string>(s),
+          std::istream_iterator<std::string>()};
+}
+
+bool Filter::matches(const std::string &path) const {
+  bool included = !hasIncludes;
+  uint32_t node{0};
+  for (size_t depth = 0;; ++depth) {
+    for (auto idx : trie[node].globs) {
+      const auto &glob = globs[idx];
+      if (included && !glob.exclude)
+        continue;
+      if (fnmatch(glob.suffix.c_str(), path.c_str() + depth, 0) == 0) {
+        if (glob.exclude)
+          return false;
+        included = true;
+      }
+    }
+    if ((included && !hasExcludes) || depth == path.size())
+      break;
+    const auto &children = trie[node].children;
+    auto it = std::find_if(
+        children.cbegin(), children.cend(),
+        [c = path[depth]](const auto &p) { return p.first == c; });
+    if (it == children.cend())
+      break;
+    node = it->second;
+  }
+  for (const auto &[re, exclude] : regexes) {
+    if (included && !exclude)
+      continue;
+    if (std::regex_search(path, re)) {
+      if (exclude)
+        return false;
+      included = true;
+    }
+  }
+  return included;
+}
+
+std::string Filter::spec() const {
+  std::string s;
+  for (const auto &p : patterns)
+    s += (s.empty() ? "" : " ") + p;
+  return s;
+}
+
+Filter::operator bool() const { return success; }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Set of include/exclude patterns compiled into a prefix trie.
+// Pattern syntax: GLOB (include), !GLOB (exclude), ~REGEX (include),
+// !~REGEX (exclude). A path passes if it matches no exclude pattern and
+// either matches an include pattern or there are no include patterns.
+class Filter {
+public:
+  Filter(const std::vector<std::string> &patterns = {});
+  static std::vector<std::string> split(const std::string &spec);
+  bool matches(const std::string &path) const;
+  std::string spec() const;
+  operator bool() const;
+
+private:
+  struct Glob {
+    std::string suffix;
+    bool exclude;
+  };
+  struct Node {
+    std::vector<std::pair<char, uint32_t>> children;
+    std::vector<uint32_t> globs;
+  };
+  std::vector<std::string> patterns;
+  std::vector<Node> trie{1};
+  std::vector<Glob> globs;
+  std::vector<std::pair<std::regex, bool>> regexes;
+  bool hasIncludes{false};
+  bool hasExcludes{false};
+  bool success{true};
+  void addGlob(const std::string &glob, bool exclude);
+};
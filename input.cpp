@@ -1,5 +1,4 @@
 #include "input.hpp"
-#include "column.hpp"
 #include "log.hpp"
 #include <cctype>
 #include <cerrno>
@@ -67,9 +66,11 @@ void Input::routine() {
         if (n == -1) {
           LOGPE("read");
           break;
+        } else if (editing) {
+          editLine(ch);
         } else if (auto opt = charToCommand(ch); opt) {
           auto [cmd, arg] = *opt;
-          cb(cmd, arg);
+          cb(cmd, arg, {});
         }
       } else if (revs & POLLERR) {
         LOGE("Received POLLERR event.");
@@ -82,6 +83,38 @@ void Input::routine() {
   }
 }
 
+void Input::startLine(const std::string &initial) {
+  editing = true;
+  line = initial;
+  cb(Command::LineEdit, 0, line);
+}
+
+void Input::editLine(char ch) {
+  switch (ch) {
+  case '\n':
+    editing = false;
+    cb(Command::LineAccept, 0, line);
+    return;
+  case '\033':
+    editing = false;
+    cb(Command::LineCancel, 0, line);
+    return;
+  case '\b':
+  case '\177':
+    // Drop UTF-8 continuation bytes together with the leading byte.
+    while (!line.empty() && (line.back() & 0xC0) == 0x80)
+      line.pop_back();
+    if (!line.empty())
+      line.pop_back();
+    break;
+  default:
+    if (static_cast<unsigned char>(ch) < ' ')
+      return;
+    line += ch;
+  }
+  cb(Command::LineEdit, 0, line);
+}
+
 std::optional<std::pair<Command, unsigned>> Input::charToCommand(char ch) {
   switch (std::toupper(ch)) {
   case 'Q':
@@ -92,8 +125,22 @@ std::optional<std::pair<Command, unsigned>> Input::charToCommand(char ch) {
     return std::make_pair(Command::Up, 0);
   case 'N':
     return std::make_pair(Command::Down, 0);
+  case 'K':
+    return std::make_pair(Command::SelectPrev, 0);
+  case 'J':
+    return std::make_pair(Command::SelectNext, 0);
+  case '\n':
+    return std::make_pair(Command::Details, 0);
+  case 'T':
+    return std::make_pair(Command::Threads, 0);
+  case 'F':
+    return std::make_pair(Command::Filter, 0);
+  case '<':
+    return std::make_pair(Command::SortingPrev, 0);
+  case '>':
+    return std::make_pair(Command::SortingNext, 0);
   default:
-    if (ch >= '0' && (unsigned)ch < '0' + ColumnsCount)
+    if (ch >= '0' && ch <= '9')
       return std::make_pair(Command::SortingColumn, ch - '0');
   }
   return std::nullopt;
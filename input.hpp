@@ -2,23 +2,45 @@
 
 #include <functional>
 #include <optional>
+#include <string>
 #include <termios.h>
 #include <thread>
 
-enum class Command { SortingColumn, SortingOrder, Down, Up, Quit };
-using InputCallback = std::function<void(Command, unsigned arg)>;
+enum class Command {
+  SortingColumn,
+  SortingPrev,
+  SortingNext,
+  SortingOrder,
+  Down,
+  Up,
+  SelectPrev,
+  SelectNext,
+  Details,
+  Threads,
+  Filter,
+  LineEdit,
+  LineAccept,
+  LineCancel,
+  Quit
+};
+using InputCallback =
+    std::function<void(Command, unsigned arg, const std::string &line)>;
 
 class Input {
 public:
   Input(InputCallback cb);
   ~Input();
+  void startLine(const std::string &initial);
 
 private:
   InputCallback cb;
+  bool editing{false};
+  std::string line;
   std::thread thread;
   int event{-1};
   termios termConf, termOrigConf;
   bool terminalConfigured{false};
   void routine();
+  void editLine(char ch);
   std::optional<std::pair<Command, unsigned>> charToCommand(char ch);
 };
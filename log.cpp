@@ -0,0 +1,180 @@
+#include "log.hpp"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <iomanip>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+static const char *logTypes[] = {"INFO", "WARN", "ERR"};
+
+Logger &Logger::instance() {
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger() {
+  for (size_t i = 0; i < ringSize; ++i)
+    ring[i].seq.store(i, std::memory_order_relaxed);
+  thread = std::thread(&Logger::threadRoutine, this);
+}
+
+Logger::~Logger() {
+  {
+    std::lock_guard lck(mtx);
+    stopReq = true;
+  }
+  cv.notify_one();
+  thread.join();
+  flush();
+  reportSuppressed();
+  if (fd != 2)
+    close(fd);
+}
+
+bool Logger::setFile(const char *path) {
+  int f = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (f == -1)
+    return false;
+  // Messages queued before are written to the new file.
+  int old;
+  {
+    std::lock_guard lck(mtxFd);
+    old = std::exchange(fd, f);
+  }
+  if (old != 2)
+    close(old);
+  return true;
+}
+
+bool Logger::admit(LogSite &site, const char *file, int line,
+                   uint32_t &suppressed) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  uint64_t window = ts.tv_sec;
+  uint64_t prev = site.window.load(std::memory_order_relaxed);
+  if (window != prev && site.window.compare_exchange_strong(prev, window))
+    site.count.store(0, std::memory_order_relaxed);
+  if (site.count.fetch_add(1, std::memory_order_relaxed) < burst) {
+    suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+  site.suppressed.fetch_add(1, std::memory_order_relaxed);
+  if (!site.listed.exchange(true)) {
+    site.file = file;
+    site.line = line;
+    site.next = sites.load();
+    while (!sites.compare_exchange_weak(site.next, &site))
+      ;
+  }
+  return false;
+}
+
+void Logger::push(const char *file, int line, LogType type,
+                  const std::string &text) {
+  size_t pos = head.load(std::memory_order_relaxed);
+  Slot *slot;
+  for (;;) {
+    slot = &ring[pos % ringSize];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+    if (diff == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  slot->time = ts.tv_sec * 1000000000ll + ts.tv_nsec;
+  slot->file = file;
+  slot->line = line;
+  slot->type = type;
+  size_t len = std::min(text.size(), maxTextSize - 1);
+  memcpy(slot->text, text.data(), len);
+  slot->text[len] = '\0';
+  slot->seq.store(pos + 1, std::memory_order_release);
+  cv.notify_one();
+}
+
+bool Logger::pop(Slot &out) {
+  auto &slot = ring[tail % ringSize];
+  if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+    return false;
+  out.time = slot.time;
+  out.file = slot.file;
+  out.line = slot.line;
+  out.type = slot.type;
+  memcpy(out.text, slot.text, sizeof(out.text));
+  slot.seq.store(tail + ringSize, std::memory_order_release);
+  ++tail;
+  return true;
+}
+
+void Logger::threadRoutine() {
+  std::unique_lock lck(mtx);
+  while (!stopReq) {
+    lck.unlock();
+    flush();
+    lck.lock();
+    // Producers do not take the lock, so a wakeup may be missed.
+    cv.wait_for(lck, std::chrono::milliseconds(100));
+  }
+}
+
+void Logger::flush() {
+  Slot slot;
+  while (pop(slot))
+    writeSlot(slot);
+  if (size_t n = dropped.exchange(0)) {
+    std::ostringstream s;
+    s << "[" << n << " message(s) dropped]\n";
+    write(s.str());
+  }
+}
+
+void Logger::writeSlot(const Slot &slot) {
+  time_t sec = slot.time / 1000000000;
+  std::tm tm;
+  localtime_r(&sec, &tm);
+  std::ostringstream s;
+  s << "[" << std::put_time(&tm, "%F %X") << "] ";
+  s << "[" << std::setw(4) << logTypes[slot.type] << "] ";
+  s << "[" << std::setw(10) << slot.file << ": " << std::setw(3) << slot.line
+    << "] ";
+  s << slot.text << '\n';
+  write(s.str());
+}
+
+void Logger::write(const std::string &line) {
+  std::lock_guard lck(mtxFd);
+  for (size_t done = 0; done < line.size();) {
+    ssize_t n = ::write(fd, line.data() + done, line.size() - done);
+    if (n <= 0 && errno != EINTR)
+      return;
+    done += n > 0 ? n : 0;
+  }
+}
+
+void Logger::reportSuppressed() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  Slot slot;
+  slot.time = ts.tv_sec * 1000000000ll + ts.tv_nsec;
+  slot.type = LogWarning;
+  for (auto site = sites.load(); site; site = site->next) {
+    if (uint32_t n = site->suppressed.exchange(0)) {
+      slot.file = site->file;
+      slot.line = site->line;
+      snprintf(slot.text, sizeof(slot.text),
+               "%u similar message(s) suppressed.", n);
+      writeSlot(slot);
+    }
+  }
+}
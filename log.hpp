@@ -1,21 +1,86 @@
 #pragma once
 
-#include <chrono>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <errno.h>
-#include <iomanip>
-#include <iostream>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
 
 enum LogType { LogInfo, LogWarning, LogError };
 
-#define LOG(lvl, fmt, ...) logImpl(__FILE__, __LINE__, lvl, fmt __VA_OPT__(,) __VA_ARGS__)
+// Every call site keeps its own rate limit state.
+#define LOG(lvl, fmt, ...)                                                     \
+  do {                                                                         \
+    static LogSite logSite;                                                    \
+    logImpl(logSite, __FILE__, __LINE__, lvl, fmt __VA_OPT__(, ) __VA_ARGS__); \
+  } while (0)
 #define LOGI(fmt, ...) LOG(LogInfo, fmt __VA_OPT__(,) __VA_ARGS__)
 #define LOGW(fmt, ...) LOG(LogWarning, fmt __VA_OPT__(,) __VA_ARGS__)
 #define LOGE(fmt, ...) LOG(LogError, fmt __VA_OPT__(,) __VA_ARGS__)
 #define LOGPE(syscall) LOGE(#syscall ": error # (#).", errno, strerror(errno))
 
-static const char *logTypes[] = {"INFO", "WARN", "ERR"};
+struct LogSite {
+  std::atomic<uint64_t> window{0};
+  std::atomic<uint32_t> count{0};
+  std::atomic<uint32_t> suppressed{0};
+  // Sites which suppressed messages are listed to report them at exit.
+  std::atomic<bool> listed{false};
+  const char *file{nullptr};
+  int line{0};
+  LogSite *next{nullptr};
+};
+
+// Messages are formatted on the calling thread, queued to a lock-free ring
+// and written by a background thread. Messages are dropped if the ring is
+// full, the logging thread never blocks.
+class Logger {
+public:
+  static Logger &instance();
+  ~Logger();
+  bool setFile(const char *path);
+  bool admit(LogSite &site, const char *file, int line, uint32_t &suppressed);
+  void push(const char *file, int line, LogType type, const std::string &text);
+  // Writes queued messages on the calling thread, e.g. in a forked child.
+  void flush();
+
+private:
+  static constexpr size_t ringSize{256};
+  static constexpr size_t maxTextSize{480};
+  // Messages per call site per second.
+  static constexpr uint32_t burst{10};
+  struct Slot {
+    std::atomic<size_t> seq;
+    int64_t time;
+    const char *file;
+    int line;
+    LogType type;
+    char text[maxTextSize];
+  };
+  std::array<Slot, ringSize> ring;
+  std::atomic<size_t> head{0};
+  size_t tail{0};
+  std::atomic<size_t> dropped{0};
+  std::atomic<LogSite *> sites{nullptr};
+  int fd{2};
+  bool stopReq{false};
+  std::mutex mtx;
+  // Held while writing and while the fd is replaced.
+  std::mutex mtxFd;
+  std::condition_variable cv;
+  std::thread thread;
+  Logger();
+  void threadRoutine();
+  bool pop(Slot &slot);
+  void write(const std::string &line);
+  void writeSlot(const Slot &slot);
+  void reportSuppressed();
+};
 
 static constexpr const char *extractFileName(const char *path) {
   const char *p = path;
@@ -42,16 +107,15 @@ void logLine(std::ostringstream &str, const char *fmt, T &&val, Ts &&...args) {
 }
 
 template <typename... Ts>
-void logImpl(const char *path, int line, LogType type, const char *fmt,
-             Ts &&...args) {
-  auto time =
-      std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-  auto localtime = std::localtime(&time);
+void logImpl(LogSite &site, const char *path, int line, LogType type,
+             const char *fmt, Ts &&...args) {
+  auto &logger = Logger::instance();
+  uint32_t suppressed;
+  if (!logger.admit(site, extractFileName(path), line, suppressed))
+    return;
   std::ostringstream s;
-  s << "[" << std::put_time(localtime, "%F %X") << "] ";
-  s << "[" << std::setw(4) << logTypes[type] << "] ";
-  s << "[" << std::setw(10) << extractFileName(path) << ": " << std::setw(3)
-    << line << "] ";
   logLine(s, fmt, args...);
-  std::cerr << s.str() << std::endl;
+  if (suppressed)
+    s << " [" << suppressed << " similar message(s) suppressed]";
+  logger.push(extractFileName(path), line, type, s.str());
 }
@@ -1,14 +1,46 @@
 #include "args.hpp"
 #include "event.hpp"
+#include "filter.hpp"
 #include "input.hpp"
+#include "log.hpp"
 #include "output.hpp"
+#include "snapshot.hpp"
+#include "symbolizer.hpp"
 #include "tracer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <iostream>
 #include <locale>
 #include <memory>
-#include <pthread.h>
+#include <mutex>
+#include <signal.h>
+#include <string_view>
+#include <thread>
 #include <unistd.h>
 
+// Set while tracing; SIGINT and SIGTERM received before are remembered.
+static std::atomic<Tracer *> runningTracer{nullptr};
+static volatile sig_atomic_t terminated{0};
+
+static void terminationHandler(int) {
+  terminated = 1;
+  if (Tracer *tracer = runningTracer)
+    tracer->stop();
+}
+
+static bool setTerminationHandler() {
+  struct sigaction act {};
+  sigemptyset(&act.sa_mask);
+  act.sa_handler = &terminationHandler;
+  if (sigaction(SIGINT, &act, nullptr) == 0 &&
+      sigaction(SIGTERM, &act, nullptr) == 0)
+    return true;
+  LOGPE("sigaction");
+  return false;
+}
+
 int main(int argc, char **argv) {
   auto locale = std::locale::global(std::locale(""));
   std::unique_ptr<std::locale, void (*)(std::locale *)> loc(
@@ -17,35 +49,109 @@ int main(int argc, char **argv) {
   ArgsParser args(argc, argv);
   if (!args)
     return EXIT_FAILURE;
+  if (auto file = args.logFile(); file && !Logger::instance().setFile(file)) {
+    LOGPE("open (log file)");
+    return EXIT_FAILURE;
+  }
+
+  if (args.diffMode()) {
+    auto [beforeFile, afterFile] = args.diffFiles();
+    Snapshot before(beforeFile), after(afterFile);
+    if (!before || !after)
+      return EXIT_FAILURE;
+    printSnapshotDiff(before, after, args.columns(), args.top(), std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  auto filter = std::make_shared<const Filter>(args.filters());
+  if (!*filter)
+    return EXIT_FAILURE;
 
-  pthread_t mainThread = pthread_self();
+  if (!setTerminationHandler())
+    return EXIT_FAILURE;
 
-  Tracer tracer =
-      args.traceeArgs() ? Tracer(args.traceeArgs()) : Tracer(args.traceePid());
+  Tracer tracer = args.traceeArgs()
+                      ? Tracer(args.traceeArgs())
+                      : Tracer(args.traceePids(),
+                               args.cgroup() ? args.cgroup() : "");
 
   std::unique_ptr<Output> output;
-  if (auto file = args.outputFile()) {
+  if (auto report = args.report()) {
+    auto format = std::string_view(report) == "json"
+                      ? Output::ReportFormat::Json
+                      : Output::ReportFormat::Table;
+    output.reset(new ReportOutput(args.outputFile(), tracer.traceePid(),
+                                  tracer.traceeCmdLine(), filter, args.delay(),
+                                  format, args.top()));
+  } else if (auto file = args.outputFile()) {
     output.reset(new FileOutput(file, tracer.traceePid(),
-                                tracer.traceeCmdLine(), args.filter(),
-                                args.delay()));
+                                tracer.traceeCmdLine(), filter, args.delay()));
   } else {
     output.reset(new TerminalOutput(tracer.traceePid(), tracer.traceeCmdLine(),
-                                    args.filter(), args.delay()));
+                                    filter, args.delay()));
+  }
+  output->setColumns(args.columns());
+  output->setMaxEntries(args.maxEntries());
+  output->setSplitPids(args.splitPids());
+  if (auto file = args.snapshotFile())
+    output->setSnapshot(file);
+  if (auto file = args.timelineFile())
+    output->setTimeline(file, args.timelineMin());
+  output->setStats(tracer.statistics());
+  if (args.samplePeriod().count()) {
+    tracer.setSampling(args.sampleOn(), args.samplePeriod());
+    output->setSampling(args.sampleOn(), args.samplePeriod());
+  }
+  if (args.stacks()) {
+    auto symbolizer = std::make_shared<Symbolizer>();
+    tracer.setSymbolizer(symbolizer);
+    output->setSymbolizer(symbolizer);
   }
   output->setSorting(args.sortType());
   if (args.reverseSorting())
     output->toggleSortingOrder();
 
-  auto inCallback = [&](Command cmd, unsigned arg) {
+  std::unique_ptr<Input> input;
+  auto inCallback = [&](Command cmd, unsigned arg, const std::string &line) {
     switch (cmd) {
     case Command::Quit:
-      pthread_kill(mainThread, SIGTERM);
+      tracer.stop();
       break;
     case Command::SortingOrder:
       output->toggleSortingOrder();
       break;
     case Command::SortingColumn:
-      output->setSorting(static_cast<Column>(arg));
+      output->setSortingIndex(arg);
+      break;
+    case Command::SortingPrev:
+      output->shiftSorting(-1);
+      break;
+    case Command::SortingNext:
+      output->shiftSorting(1);
+      break;
+    case Command::Details:
+      output->toggleDetails();
+      break;
+    case Command::Threads:
+      output->toggleThreads();
+      break;
+    case Command::Filter:
+      input->startLine(output->currentFilter()->spec());
+      break;
+    case Command::LineEdit:
+      output->setPrompt("filter: " + line);
+      break;
+    case Command::LineAccept: {
+      output->setPrompt({});
+      auto f = std::make_shared<const Filter>(Filter::split(line));
+      if (*f) {
+        tracer.setFilter(f);
+        output->setFilter(f);
+      }
+      break;
+    }
+    case Command::LineCancel:
+      output->setPrompt({});
       break;
     case Command::Up:
       if (auto out = dynamic_cast<TerminalOutput *>(output.get()))
@@ -55,15 +161,50 @@ int main(int argc, char **argv) {
       if (auto out = dynamic_cast<TerminalOutput *>(output.get()))
         out->pageDown();
       break;
+    case Command::SelectPrev:
+      if (auto out = dynamic_cast<TerminalOutput *>(output.get()))
+        out->selectPrev();
+      break;
+    case Command::SelectNext:
+      if (auto out = dynamic_cast<TerminalOutput *>(output.get()))
+        out->selectNext();
+      break;
     }
   };
 
-  std::unique_ptr<Input> input;
-  if (!args.outputFile())
+  if (!args.outputFile() && !args.report())
     input.reset(new Input(inCallback));
 
   auto outCallback = [&](const EventInfo &ei) { output->queueEvent(ei); };
   tracer.setOutputCallback(outCallback);
+  tracer.setBacklogCallback([&] { return output->backlog(); });
+  tracer.setFilter(filter);
 
-  return tracer.loop() ? EXIT_SUCCESS : EXIT_FAILURE;
+  // Ends the run once the duration elapses.
+  std::mutex mtxTimer;
+  std::condition_variable cvTimer;
+  bool traced{false};
+  std::thread timer;
+  if (args.duration()) {
+    timer = std::thread([&] {
+      std::unique_lock lck(mtxTimer);
+      std::chrono::duration<double> duration(args.duration());
+      if (!cvTimer.wait_for(lck, duration, [&] { return traced; }))
+        tracer.stop();
+    });
+  }
+  runningTracer = &tracer;
+  if (terminated)
+    tracer.stop();
+  bool ok = tracer.loop();
+  runningTracer = nullptr;
+  if (timer.joinable()) {
+    {
+      std::lock_guard lck(mtxTimer);
+      traced = true;
+    }
+    cvTimer.notify_one();
+    timer.join();
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,216 @@
+#include "mapsampler.hpp"
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+MapSampler::MapSampler(std::chrono::duration<double> interval)
+    : interval(interval) {
+  thread = std::thread(&MapSampler::threadRoutine, this);
+}
+
+MapSampler::~MapSampler() {
+  {
+    std::lock_guard lck(mtx);
+    stopReq = true;
+  }
+  cv.notify_one();
+  thread.join();
+}
+
+void MapSampler::watch(const std::set<FileKey> &f,
+                       std::vector<std::pair<pid_t, pid_t>> t) {
+  std::lock_guard lck(mtx);
+  // Copying is skipped while the set is unchanged, which is the usual case.
+  if (files != f)
+    files = f;
+  threads = std::move(t);
+}
+
+std::vector<MapSampler::Delta> MapSampler::takeDeltas() {
+  std::vector<Delta> deltas;
+  std::lock_guard lck(mtx);
+  deltas.reserve(pending.size());
+  for (auto &[key, sizes] : pending)
+    deltas.push_back({key.first, key.second, sizes.first, sizes.second});
+  pending.clear();
+  return deltas;
+}
+
+std::unordered_map<pid_t, MapSampler::ThreadCounters>
+MapSampler::threadCounters() const {
+  std::lock_guard lck(mtx);
+  return counters;
+}
+
+void MapSampler::threadRoutine() {
+  std::unique_lock lck(mtx);
+  while (!stopReq) {
+    cv.wait_for(lck, interval, [this] { return stopReq; });
+    if (stopReq)
+      break;
+    auto f = files;
+    auto t = threads;
+    lck.unlock();
+    sample(f, t);
+    lck.lock();
+  }
+}
+
+void MapSampler::sample(const std::set<FileKey> &f,
+                        const std::vector<std::pair<pid_t, pid_t>> &t) {
+  std::map<FileKey, std::pair<size_t, size_t>> deltas;
+  std::map<FileKey, Usage> current;
+  std::unordered_map<std::string, Usage> usage;
+  std::set<pid_t> pids;
+  for (const auto &key : f)
+    pids.insert(key.first);
+  for (pid_t pid : pids) {
+    usage.clear();
+    if (!readSmaps(pid, usage))
+      continue;
+    for (auto &[path, u] : usage) {
+      FileKey key{pid, path};
+      Usage prev{};
+      if (auto it = last.find(key); it != last.end())
+        prev = it->second;
+      else if (!f.contains(key))
+        prev = u;
+      size_t read = u.rss > prev.rss ? u.rss - prev.rss : 0;
+      size_t dirty = u.dirty > prev.dirty ? u.dirty - prev.dirty : 0;
+      if (read || dirty)
+        deltas[key] = {read, dirty};
+      current.emplace(std::move(key), u);
+    }
+  }
+  last = std::move(current);
+  std::unordered_map<pid_t, ThreadCounters> counts;
+  for (auto [tid, pid] : t)
+    if (auto c = readThreadCounters(tid, pid))
+      counts.emplace(tid, *c);
+  std::lock_guard lck(mtx);
+  for (auto &[key, d] : deltas) {
+    auto &sum = pending[key];
+    sum.first += d.first;
+    sum.second += d.second;
+  }
+  // Exited threads keep their last counters.
+  for (auto &[tid, c] : counts)
+    counters[tid] = c;
+}
+
+bool MapSampler::readSmaps(pid_t pid,
+                           std::unordered_map<std::string, Usage> &usage) {
+  std::string path = "/proc/" + std::to_string(pid) + "/smaps";
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  // The file is parsed as it is read, it may be many megabytes long.
+  char buf[bufferSize];
+  std::string partial;
+  Usage *current{nullptr};
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    size_t begin = 0;
+    for (size_t i = 0; i < size_t(n); ++i) {
+      if (buf[i] != '\n')
+        continue;
+      std::string_view line(buf + begin, i - begin);
+      if (!partial.empty()) {
+        partial.append(line);
+        line = partial;
+      }
+      parseSmapsLine(line, current, usage);
+      partial.clear();
+      begin = i + 1;
+    }
+    partial.append(buf + begin, n - begin);
+  }
+  close(fd);
+  return n == 0;
+}
+
+void MapSampler::parseSmapsLine(std::string_view line, Usage *&current,
+                                std::unordered_map<std::string, Usage> &usage) {
+  if (line.empty())
+    return;
+  if (char c = line.front(); (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) {
+    // Mapping header: address perms offset dev inode [path].
+    current = nullptr;
+    size_t pos = 0;
+    for (int field = 0; field < 5 && pos != line.npos; ++field) {
+      pos = line.find(' ', pos);
+      if (pos != line.npos)
+        pos = line.find_first_not_of(' ', pos);
+    }
+    if (pos == line.npos || line[pos] != '/')
+      return;
+    auto path = line.substr(pos);
+    static constexpr std::string_view deleted{" (deleted)"};
+    if (path.ends_with(deleted))
+      path.remove_suffix(deleted.size());
+    current = &usage[std::string(path)];
+    return;
+  }
+  if (!current)
+    return;
+  size_t *counter;
+  if (line.starts_with("Rss:"))
+    counter = &current->rss;
+  else if (line.starts_with("Private_Dirty:") ||
+           line.starts_with("Shared_Dirty:"))
+    counter = &current->dirty;
+  else
+    return;
+  size_t pos = line.find_first_of("0123456789");
+  if (pos == line.npos)
+    return;
+  size_t kb{0};
+  std::from_chars(line.data() + pos, line.data() + line.size(), kb);
+  *counter += kb * 1024;
+}
+
+std::optional<MapSampler::ThreadCounters>
+MapSampler::readThreadCounters(pid_t tid, pid_t pid) {
+  // /proc/<tid>/... would sum the counters of the whole process.
+  std::string dir = "/proc/" + std::to_string(pid) + "/task/" +
+                    std::to_string(tid) + "/";
+  std::ifstream file(dir + "stat");
+  std::string stat;
+  if (!std::getline(file, stat))
+    return std::nullopt;
+  // Fields after the command name, which may contain spaces: state ppid
+  // pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime
+  // stime cutime cstime priority nice num_threads itrealvalue starttime.
+  size_t pos = stat.rfind(')');
+  if (pos == std::string::npos)
+    return std::nullopt;
+  std::istringstream fields(stat.substr(pos + 1));
+  std::string skip;
+  for (int i = 0; i < 9; ++i)
+    fields >> skip;
+  ThreadCounters c;
+  uint64_t startTicks;
+  fields >> c.majorFaults;
+  for (int i = 0; i < 9; ++i)
+    fields >> skip;
+  if (!(fields >> startTicks))
+    return std::nullopt;
+  static const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+  c.startTime = startTicks * (1000000000ull / ticksPerSecond);
+  std::ifstream io(dir + "io");
+  std::string key;
+  size_t value, cancelled{0};
+  while (io >> key >> value) {
+    if (key == "read_bytes:")
+      c.readBytes = value;
+    else if (key == "write_bytes:")
+      c.writeBytes = value;
+    else if (key == "cancelled_write_bytes:")
+      cancelled = value;
+  }
+  c.writeBytes -= std::min(c.writeBytes, cancelled);
+  return c;
+}
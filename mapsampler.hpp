@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Estimates I/O through memory mapped files, which has no syscalls to
+// trace. /proc/<pid>/smaps of the watched processes is read periodically;
+// the growth of the resident and dirty sizes of file mappings is taken as
+// bytes read and written. Major faults and storage I/O of the watched
+// threads are read from /proc/<pid>/task/<tid>/{stat,io}.
+class MapSampler {
+public:
+  struct ThreadCounters {
+    size_t majorFaults{0};
+    // Bytes the thread caused to be fetched from and sent to storage, less
+    // writes cancelled by truncation.
+    size_t readBytes{0};
+    size_t writeBytes{0};
+    // CLOCK_BOOTTIME nanoseconds.
+    uint64_t startTime{0};
+  };
+  struct Delta {
+    pid_t pid;
+    std::string path;
+    size_t readSize;
+    size_t dirtySize;
+  };
+  MapSampler(std::chrono::duration<double> interval);
+  MapSampler(const MapSampler &) = delete;
+  MapSampler &operator=(const MapSampler &) = delete;
+  ~MapSampler();
+  using FileKey = std::pair<pid_t, std::string>;
+  // Sets the (process, path) pairs mapped since tracing started and the
+  // (thread, process) pairs whose counters are sampled. The resident
+  // size of other mappings of these processes is only counted from the
+  // first sample.
+  void watch(const std::set<FileKey> &files,
+             std::vector<std::pair<pid_t, pid_t>> threads);
+  // Growth since the previous call.
+  std::vector<Delta> takeDeltas();
+  // Latest counters of each watched thread.
+  std::unordered_map<pid_t, ThreadCounters> threadCounters() const;
+  static std::optional<ThreadCounters> readThreadCounters(pid_t tid,
+                                                          pid_t pid);
+
+private:
+  struct Usage {
+    size_t rss{0};
+    size_t dirty{0};
+  };
+  static constexpr size_t bufferSize{65536};
+  std::chrono::duration<double> interval;
+  // Sampler thread state.
+  std::map<FileKey, Usage> last;
+  // Shared state.
+  std::set<FileKey> files;
+  std::vector<std::pair<pid_t, pid_t>> threads;
+  std::map<FileKey, std::pair<size_t, size_t>> pending;
+  std::unordered_map<pid_t, ThreadCounters> counters;
+  bool stopReq{false};
+  mutable std::mutex mtx;
+  std::condition_variable cv;
+  std::thread thread;
+  void threadRoutine();
+  void sample(const std::set<FileKey> &files,
+              const std::vector<std::pair<pid_t, pid_t>> &threads);
+  static bool readSmaps(pid_t pid,
+                        std::unordered_map<std::string, Usage> &usage);
+  static void parseSmapsLine(std::string_view line, Usage *&current,
+                             std::unordered_map<std::string, Usage> &usage);
+};
@@ -1,11 +1,13 @@
 #include "output.hpp"
 #include "column.hpp"
+#include "log.hpp"
 #include <algorithm>
+#include <bit>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
-#include <fnmatch.h>
+#include <errno.h>
 #include <iomanip>
 #include <iterator>
 #include <limits>
@@ -13,14 +15,18 @@
 #include <numeric>
 #include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-Output::Output(pid_t pid, const std::string &cmd, const std::string &filter,
-               unsigned delay)
-    : pid(pid), cmd(conv.from_bytes(cmd)), filter(filter), delay(delay) {
-  nonPathColsWidth = std::accumulate(&colWidth[ColPath + 1],
-                                     &colWidth[ColumnsCount], idxWidth);
+Output::Output(pid_t pid, const std::string &cmd,
+               std::shared_ptr<const Filter> filter, double delay)
+    : Aggregator(filter),
+      columns(std::cbegin(defaultColumns), std::cend(defaultColumns)),
+      pid(pid), cmd(conv.from_bytes(cmd)), delay(delay) {
+  shownColumns = columns;
+  updateNonPathColsWidth();
 }
 
 Output::~Output() {}
@@ -32,19 +38,32 @@ void Output::threadRoutine() {
     bool emptyQueue, updateReq;
     {
       std::unique_lock lck(mtxEvents);
+      // Headless runs aggregate events in batches of the update interval.
       cv.wait_for(lck, duration, [this] {
-        return !eventsQueue.empty() || terminateReqEvent || updateReqEvent;
+        return terminateReqEvent ||
+               (!headless && (!eventsQueue.empty() || updateReqEvent));
       });
       emptyQueue = eventsQueue.empty();
       updateReq = updateReqEvent;
       terminateReq = terminateReqEvent;
       updateReqEvent = false;
     }
+    if (updateReq)
+      applyFilter();
     if (!emptyQueue) {
       processEvents();
       listChanged = true;
     }
     auto t = std::chrono::steady_clock::now();
+    if (t - lastMapSampleTime >= delay || terminateReq) {
+      if (collectMapSamples())
+        listChanged = true;
+      if (collectCacheSamples())
+        listChanged = true;
+      lastMapSampleTime = t;
+    }
+    if (headless)
+      continue;
     auto d = t - lastUpdateTime;
     if (d >= delay || updateReq || terminateReq) {
       update(updateReq || listChanged);
@@ -58,8 +77,11 @@ void Output::threadRoutine() {
 }
 
 void Output::start() {
-  if (!thread.joinable())
+  if (!thread.joinable()) {
+    mapSampler = std::make_unique<MapSampler>(delay);
+    cacheSampler = std::make_unique<CacheSampler>(delay);
     thread = std::thread(&Output::threadRoutine, this);
+  }
 }
 
 void Output::stop() {
@@ -70,6 +92,10 @@ void Output::stop() {
     }
     cv.notify_one();
     thread.join();
+    if (!snapshotPath.empty())
+      saveSnapshot();
+    // Closes the trace.
+    timeline.reset();
   }
 }
 
@@ -89,6 +115,84 @@ void Output::setSorting(Column column) {
   requestUpdate();
 }
 
+void Output::setSortingIndex(size_t index) {
+  {
+    std::lock_guard lck(mtxParams);
+    if (index >= columns.size())
+      return;
+    sorting = columns[index];
+  }
+  requestUpdate();
+}
+
+void Output::shiftSorting(int delta) {
+  {
+    std::lock_guard lck(mtxParams);
+    int n = columns.size();
+    auto it = std::find(columns.cbegin(), columns.cend(), sorting);
+    int pos = it == columns.cend() ? 0 : std::distance(columns.cbegin(), it);
+    sorting = columns[((pos + delta) % n + n) % n];
+  }
+  requestUpdate();
+}
+
+void Output::setColumns(const std::vector<Column> &cols) {
+  {
+    std::lock_guard lck(mtxParams);
+    columns = {ColPath};
+    std::copy_if(cols.cbegin(), cols.cend(), std::back_inserter(columns),
+                 [](Column c) { return c != ColPath; });
+  }
+  requestUpdate();
+}
+
+void Output::toggleDetails() {
+  {
+    std::lock_guard lck(mtxParams);
+    details = !details;
+  }
+  requestUpdate();
+}
+
+void Output::toggleThreads() {
+  {
+    std::lock_guard lck(mtxParams);
+    view = view == View::Files ? View::Threads : View::Files;
+    details = false;
+  }
+  requestUpdate();
+}
+
+void Output::setFilter(std::shared_ptr<const Filter> f) {
+  {
+    std::lock_guard lck(mtxParams);
+    pendingFilter = f;
+  }
+  requestUpdate();
+}
+
+std::shared_ptr<const Filter> Output::currentFilter() const {
+  std::lock_guard lck(mtxParams);
+  return pendingFilter ? pendingFilter : filter;
+}
+
+void Output::setPrompt(const std::string &p) {
+  {
+    std::lock_guard lck(mtxParams);
+    prompt = conv.from_bytes(p);
+  }
+  requestUpdate();
+}
+
+void Output::setSnapshot(const std::string &path) { snapshotPath = path; }
+
+void Output::setTimeline(const std::string &path, uint64_t minDuration) {
+  auto t = std::make_unique<Timeline>(path, minDuration);
+  std::lock_guard lck(mtxParams);
+  if (*t)
+    timeline = std::move(t);
+}
+
 void Output::toggleSortingOrder() {
   {
     std::lock_guard lck(mtxParams);
@@ -105,109 +209,399 @@ void Output::queueEvent(const EventInfo &info) {
   cv.notify_one();
 }
 
+size_t Output::backlog() const {
+  std::lock_guard lck(mtxEvents);
+  return eventsQueue.size() + processedBatch;
+}
+
 void Output::processEvents() {
   std::queue<EventInfo> eventsQueueCopy;
   {
     std::lock_guard lck(mtxEvents);
     std::swap(eventsQueue, eventsQueueCopy);
+    processedBatch = eventsQueueCopy.size();
   }
   for (; !eventsQueueCopy.empty(); eventsQueueCopy.pop()) {
     EventInfo &info = eventsQueueCopy.front();
-    if (info.path.empty())
+    if (timeline)
+      timeline->add(info);
+    if (auto entry = process(info))
+      countThreadIo(*entry, info);
+  }
+  processedBatch = 0;
+  evictEntries();
+}
+
+bool Output::collectMapSamples() {
+  std::vector<std::pair<pid_t, pid_t>> tids;
+  tids.reserve(threads.size());
+  for (const auto &[tid, thread] : threads)
+    tids.emplace_back(tid, thread.pid);
+  mapSampler->watch(mappedFiles, std::move(tids));
+  bool changed{false};
+  for (auto &delta : mapSampler->takeDeltas()) {
+    auto it = hashmap.find({splitPids ? delta.pid : 0, delta.path});
+    if (it == hashmap.end() ||
+        !(it->second->specialEvents & Entry::EventMapped))
       continue;
-    info.path = fixRelativePath(info.path);
-    if (!info.strArg.empty())
-      info.strArg = fixRelativePath(info.strArg);
-    if (auto c = info.path.front(); c != '/' && c != '*')
+    it->second->mapReadSize += delta.readSize;
+    it->second->mapDirtySize += delta.dirtySize;
+    changed = true;
+  }
+  auto since = [](size_t value, size_t base) {
+    return value > base ? value - base : 0;
+  };
+  for (auto [tid, c] : mapSampler->threadCounters()) {
+    auto it = threads.find(tid);
+    if (it == threads.end())
       continue;
-    auto [item, inserted] = getEntry(info.path);
-    if (inserted)
-      item.filtered = fnmatch(filter.c_str(), info.path.c_str(), 0) == 0;
-    item.lastThread = info.pid;
-    item.lastAccess = now();
-    if (!info.exists)
-      item.specialEvents |= Entry::EventUnlinked;
-    switch (info.type) {
-    case Event::Open: {
-      ++item.openCount;
-      break;
-    }
-    case Event::Close: {
-      ++item.closeCount;
-      break;
-    }
-    case Event::Read: {
-      ++item.readCount;
-      item.readSize += info.sizeArg;
-      break;
-    }
-    case Event::Write: {
-      ++item.writeCount;
-      item.writeSize += info.sizeArg;
-      break;
-    }
-    case Event::Map: {
-      item.specialEvents |= Entry::EventMapped;
-      break;
-    }
-    case Event::Rename: {
-      item.specialEvents |= Entry::EventRenamed;
-      auto src = item;
-      auto [dst, inserted] = getEntry(info.strArg);
-      dst.openCount += src.openCount;
-      dst.closeCount += src.closeCount;
-      dst.readCount += src.readCount;
-      dst.writeCount += src.writeCount;
-      dst.readSize += src.readSize;
-      dst.writeSize += src.writeSize;
-      dst.lastThread = src.lastThread;
-      dst.lastAccess = src.lastAccess;
-      break;
-    }
-    case Event::Unlink: {
-      item.specialEvents |= Entry::EventUnlinked;
-      break;
+    auto &base = it->second.sampledBase;
+    it->second.sampled = {since(c.majorFaults, base.majorFaults),
+                          since(c.readBytes, base.readBytes),
+                          since(c.writeBytes, base.writeBytes)};
+  }
+  return changed;
+}
+
+bool Output::collectCacheSamples() {
+  {
+    std::lock_guard lck(mtxParams);
+    if (std::find(columns.cbegin(), columns.cend(), ColCached) ==
+        columns.cend())
+      return false;
+  }
+  std::vector<const Entry *> top;
+  for (const auto &entry : list)
+    if (entry.filtered && entry.readSize && entry.path.front() == '/')
+      top.push_back(&entry);
+  auto bySize = [](const Entry *a, const Entry *b) {
+    return a->readSize > b->readSize;
+  };
+  if (top.size() > cacheSampledFiles) {
+    std::nth_element(top.begin(), top.begin() + cacheSampledFiles, top.end(),
+                     bySize);
+    top.resize(cacheSampledFiles);
+  }
+  std::vector<std::string> paths;
+  for (auto entry : top)
+    if (std::find(paths.cbegin(), paths.cend(), entry->path) == paths.cend())
+      paths.push_back(entry->path);
+  cacheSampler->watch(std::move(paths));
+  auto results = cacheSampler->results();
+  bool changed{false};
+  for (auto &entry : list) {
+    if (auto it = results.find(entry.path);
+        it != results.end() && it->second != entry.cachedPercent) {
+      entry.cachedPercent = it->second;
+      changed = true;
     }
+  }
+  return changed;
+}
+
+void Output::onEvict(const std::unordered_set<const Entry *> &victims,
+                     Entry &evicted) {
+  for (auto &[tid, thread] : threads) {
+    for (auto it = thread.files.begin(); it != thread.files.end();) {
+      if (victims.count(it->first)) {
+        thread.otherFiles.add(it->second);
+        it = thread.files.erase(it);
+        --threadFilesCount;
+      } else {
+        ++it;
+      }
     }
   }
+  if (victims.count(detailed))
+    detailed = &evicted;
+}
+
+void Output::applyFilter() {
+  {
+    std::lock_guard lck(mtxParams);
+    if (!pendingFilter)
+      return;
+    filter = std::move(pendingFilter);
+  }
+  std::vector<Entry *> entries;
+  entries.reserve(list.size());
+  for (auto &e : list)
+    entries.push_back(&e);
+  auto evaluate = [this, &entries](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      entries[i]->filtered = filter->matches(entries[i]->path);
+  };
+  size_t chunks = (entries.size() + filterChunkSize - 1) / filterChunkSize;
+  size_t nThreads = std::min<size_t>(
+      chunks, std::max(1u, std::thread::hardware_concurrency()));
+  if (nThreads <= 1) {
+    evaluate(0, entries.size());
+    return;
+  }
+  std::vector<std::thread> workers;
+  size_t step = (entries.size() + nThreads - 1) / nThreads;
+  for (size_t begin = 0; begin < entries.size(); begin += step)
+    workers.emplace_back(evaluate, begin,
+                         std::min(begin + step, entries.size()));
+  for (auto &w : workers)
+    w.join();
 }
 
 void Output::update(bool recollect) {
   clear();
+  render(recollect);
+  present();
+}
+
+void Output::render(bool recollect) {
+  bool showDetails;
+  View v;
+  {
+    std::lock_guard lck(mtxParams);
+    if (shownColumns != columns) {
+      shownColumns = columns;
+      updateNonPathColsWidth();
+    }
+    showDetails = details;
+    v = view;
+  }
+  updateScale();
+  if (v != shownView) {
+    shownView = v;
+    detailed = nullptr;
+    detailedThread = 0;
+    resetSelection();
+  }
   printProcessInfo();
   if (maxWidth() < nonPathColsWidth + minPathColWidth) {
     stream() << "[insufficient width]\n";
     return;
   }
   if (recollect) {
-    std::lock_guard lck(mtxCount);
     filteredCount = 0;
     sort();
     maxPathWidth = 0;
     for (const auto &e : list) {
       if (e.filtered) {
         ++filteredCount;
-        maxPathWidth = std::max(maxPathWidth, e.path.size());
+        maxPathWidth = std::max(maxPathWidth, displayLength(e.path));
       }
     }
   }
+  if (v == View::Threads)
+    printThreads(showDetails);
+  else
+    printFiles(showDetails);
+}
+
+void Output::printFiles(bool showDetails) {
+  setCount(filteredCount);
+  if (!showDetails) {
+    detailed = nullptr;
+  } else if (auto sel = selection(); !detailed && sel && *sel < count()) {
+    detailed = &*std::next(list.cbegin(), *sel);
+  }
+  if (detailed) {
+    printDetails(*detailed);
+    return;
+  }
   if (!maxPathWidth)
     return;
-  colWidth[ColPath] = std::min(maxPathWidth, maxWidth() - nonPathColsWidth);
+  colWidth[ColPath] = std::max(
+      minPathColWidth, std::min(maxPathWidth, maxWidth() - nonPathColsWidth));
   printColumnHeaders();
   auto [begin, end] = linesRange();
   begin = std::min(begin, count());
   end = std::min(end, count());
+  auto sel = selection();
   auto it = list.cbegin();
   for (size_t i = 0; i < end; ++i, ++it) {
-    if (i >= begin)
+    if (i >= begin) {
+      bool selected = sel == i;
+      if (selected)
+        highlight(true);
       printEntry(i + 1, *it);
+      if (selected)
+        highlight(false);
+      stream() << std::endl;
+    }
+  }
+}
+
+void Output::printThreads(bool showDetails) {
+  struct Row {
+    pid_t tid;
+    const ThreadEntry *thread;
+    IoCounters io;
+    size_t files;
+  };
+  std::vector<Row> rows;
+  rows.reserve(threads.size());
+  for (const auto &[tid, thread] : threads) {
+    size_t files;
+    auto io = threadIo(thread, &files);
+    rows.push_back({tid, &thread, io, files});
+  }
+  auto volume = [](const Row &r) { return r.io.writeSize + r.io.readSize; };
+  std::sort(rows.begin(), rows.end(), [&](const Row &a, const Row &b) {
+    return volume(a) != volume(b) ? volume(a) > volume(b) : a.tid < b.tid;
+  });
+  if (!showDetails) {
+    if (detailedThread) {
+      detailedThread = 0;
+      resetSelection();
+    }
+  } else if (auto sel = selection(); !detailedThread && sel) {
+    if (*sel < rows.size()) {
+      detailedThread = rows[*sel].tid;
+      resetSelection();
+    }
+  }
+  if (detailedThread) {
+    if (auto it = threads.find(detailedThread); it != threads.end())
+      printThreadFiles(it->first, it->second);
+    return;
+  }
+  setCount(rows.size());
+  auto &s = stream();
+  if (visibleControlHints() && !printPrompt())
+    s << L"[t]:threads [n]↓ [p]↑ [q]" << std::endl;
+  std::wstring sCount = L"(" + std::to_wstring(rows.size()) +
+                        (rows.size() == 1 ? L" thread" : L" threads") + L")";
+  s << std::left << std::setw(idxWidth + threadNameWidth) << sCount
+    << std::right << std::setw(colWidth[ColLastThread]) << "tid";
+  for (auto col : {ColWriteSize, ColReadSize, ColWriteCount, ColReadCount,
+                   ColOpenCount})
+    s << std::setw(colWidth[col]) << columnNames[col];
+  s << std::setw(colWidth[ColOpenCount]) << "files"
+    << std::setw(colWidth[ColOpenCount]) << "majflt"
+    << std::setw(colWidth[ColOpenCount]) << "rdisk%"
+    << std::setw(colWidth[ColOpenCount]) << "wdisk%" << std::endl;
+  auto [begin, end] = linesRange();
+  end = std::min(end, rows.size());
+  auto sel = selection();
+  for (size_t i = begin; i < end; ++i) {
+    const auto &[tid, thread, io, files] = rows[i];
+    bool selected = sel == i;
+    if (selected)
+      highlight(true);
+    s << std::left << std::setw(idxWidth) << i + 1 << std::setw(threadNameWidth)
+      << truncString(thread->name, threadNameWidth - 1, false) << std::right
+      << std::setw(colWidth[ColLastThread]) << tid;
+    printIoCounters(io);
+    s << std::setw(colWidth[ColOpenCount]) << files
+      << std::setw(colWidth[ColOpenCount]) << thread->sampled.majorFaults
+      << std::setw(colWidth[ColOpenCount])
+      << diskRatio(thread->sampled.readBytes, thread->fileReadSize).c_str()
+      << std::setw(colWidth[ColOpenCount])
+      << diskRatio(thread->sampled.writeBytes, thread->fileWriteSize).c_str();
+    if (selected)
+      highlight(false);
+    s << std::endl;
+  }
+}
+
+void Output::printThreadFiles(pid_t tid, const ThreadEntry &thread) {
+  using Row = std::pair<const Entry *, const IoCounters *>;
+  std::vector<Row> rows;
+  rows.reserve(thread.files.size());
+  for (const auto &[entry, io] : thread.files) {
+    if (entry->filtered)
+      rows.emplace_back(entry, &io);
+  }
+  auto volume = [](const Row &r) {
+    return r.second->writeSize + r.second->readSize;
+  };
+  std::sort(rows.begin(), rows.end(), [&](const Row &a, const Row &b) {
+    return volume(a) != volume(b) ? volume(a) > volume(b)
+                                  : a.first->path < b.first->path;
+  });
+  setCount(rows.size());
+  auto &s = stream();
+  if (!printPrompt())
+    s << L"Thread " << tid << L" (" << thread.name << L"): " << rows.size()
+      << (rows.size() == 1 ? L" file" : L" files") << std::endl;
+  constexpr Column cols[]{ColWriteSize, ColReadSize, ColWriteCount,
+                          ColReadCount, ColOpenCount};
+  size_t width = std::accumulate(std::cbegin(cols), std::cend(cols), idxWidth,
+                                 [this](size_t acc, Column c) {
+                                   return acc + colWidth[c];
+                                 });
+  size_t pathWidth = maxWidth() > width ? maxWidth() - width : 0;
+  s << std::setw(idxWidth + pathWidth) << columnNames[ColPath];
+  for (auto col : cols)
+    s << std::setw(colWidth[col]) << columnNames[col];
+  s << std::endl;
+  auto [begin, end] = linesRange();
+  end = std::min(end, rows.size());
+  for (size_t i = begin; i < end; ++i) {
+    s << std::left << std::setw(idxWidth) << i + 1 << std::right
+      << std::setw(pathWidth)
+      << truncString(conv.from_bytes(rows[i].first->path), pathWidth, true);
+    printIoCounters(*rows[i].second);
+    s << std::endl;
+  }
+  if (end == rows.size() && thread.otherFiles.openCount +
+                                    thread.otherFiles.readCount +
+                                    thread.otherFiles.writeCount) {
+    s << std::setw(idxWidth + pathWidth) << "*OTHER FILES*";
+    printIoCounters(thread.otherFiles);
+    s << std::endl;
   }
 }
 
+bool Output::printPrompt() {
+  std::wstring p;
+  {
+    std::lock_guard lck(mtxParams);
+    p = prompt;
+  }
+  if (p.empty())
+    return false;
+  stream() << truncString(p + L"_", maxWidth(), true) << std::endl;
+  return true;
+}
+
+Output::IoCounters Output::threadIo(const ThreadEntry &thread,
+                                    size_t *files) const {
+  IoCounters io = thread.otherFiles;
+  *files = 0;
+  for (const auto &[entry, counters] : thread.files) {
+    if (entry->filtered) {
+      io.add(counters);
+      ++*files;
+    }
+  }
+  return io;
+}
+
+void Output::IoCounters::add(const IoCounters &other) {
+  writeSize += other.writeSize;
+  readSize += other.readSize;
+  writeCount += other.writeCount;
+  readCount += other.readCount;
+  openCount += other.openCount;
+}
+
+void Output::printIoCounters(const IoCounters &io) {
+  auto &s = stream();
+  s << std::setw(colWidth[ColWriteSize])
+    << formatSize(estimate(io.writeSize)).c_str()
+    << std::setw(colWidth[ColReadSize])
+    << formatSize(estimate(io.readSize)).c_str()
+    << std::setw(colWidth[ColWriteCount]) << estimate(io.writeCount)
+    << std::setw(colWidth[ColReadCount]) << estimate(io.readCount)
+    << std::setw(colWidth[ColOpenCount]) << estimate(io.openCount);
+}
+
+void Output::setCount(size_t count) {
+  std::lock_guard lck(mtxCount);
+  rowsCount = count;
+}
+
 size_t Output::count() const {
   std::lock_guard lck(mtxCount);
-  return filteredCount;
+  return rowsCount;
 }
 
 void Output::sort() {
@@ -229,16 +623,45 @@ void Output::sort() {
       return f.readCount < s.readCount;
     case ColOpenCount:
       return f.openCount < s.openCount;
+    case ColWriteAvg:
+      return average(f.writeSize, f.writeCount) <
+             average(s.writeSize, s.writeCount);
+    case ColReadAvg:
+      return average(f.readSize, f.readCount) <
+             average(s.readSize, s.readCount);
+    case ColSmallOps:
+      return smallOpsPercent(f) < smallOpsPercent(s);
     case ColCloseCount:
       return f.closeCount < s.closeCount;
+    case ColOpenNow:
+      return f.openNow < s.openNow;
+    case ColOpenAvg:
+      return average(f.lifetime, f.lifetimeCount) <
+             average(s.lifetime, s.lifetimeCount);
+    case ColOpenMax:
+      return f.lifetimeMax < s.lifetimeMax;
+    case ColUnclosed:
+      return f.unclosedCount < s.unclosedCount;
+    case ColSyncCount:
+      return f.syncCount < s.syncCount;
+    case ColSyncTime:
+      return f.syncTime < s.syncTime;
+    case ColSyncMax:
+      return f.syncMaxTime < s.syncMaxTime;
+    case ColMapRead:
+      return f.mapReadSize < s.mapReadSize;
+    case ColMapDirty:
+      return f.mapDirtySize < s.mapDirtySize;
+    case ColCached:
+      return f.cachedPercent < s.cachedPercent;
     case ColSpecialEvents:
       return f.specialEvents < s.specialEvents;
+    case ColProcess:
+      return f.pid < s.pid;
     case ColLastThread:
       return f.lastThread < s.lastThread;
-    case ColLastAccess: {
-      auto ft = f.lastAccess, st = s.lastAccess;
-      return timegm(&ft) < timegm(&st);
-    }
+    case ColLastAccess:
+      return f.lastAccess < s.lastAccess;
     default:
       return true;
     }
@@ -250,36 +673,189 @@ void Output::sort() {
 void Output::printEntry(size_t index, const Entry &entry) {
   auto &s = stream();
   s << std::left << std::setw(idxWidth) << index << std::right;
-  s << std::setw(colWidth[ColPath])
-    << truncString(entry.path, colWidth[ColPath], true);
-  s << std::setw(colWidth[ColWriteSize]) << formatSize(entry.writeSize).c_str();
-  s << std::setw(colWidth[ColReadSize]) << formatSize(entry.readSize).c_str();
-  s << std::setw(colWidth[ColWriteCount]) << entry.writeCount;
-  s << std::setw(colWidth[ColReadCount]) << entry.readCount;
-  s << std::setw(colWidth[ColOpenCount]) << entry.openCount;
-  s << std::setw(colWidth[ColCloseCount]) << entry.closeCount;
-  s << std::setw(colWidth[ColSpecialEvents])
-    << formatEvents(entry.specialEvents).c_str();
-  s << std::setw(colWidth[ColLastThread]) << entry.lastThread;
-  char timeString[50];
-  std::strftime(timeString, sizeof(timeString), "%X", &entry.lastAccess);
-  s << std::setw(colWidth[ColLastAccess]) << conv.from_bytes(timeString);
+  for (auto col : shownColumns) {
+    s << std::setw(colWidth[col]);
+    switch (col) {
+    case ColPath:
+      s << truncString(conv.from_bytes(entry.path), colWidth[ColPath], true);
+      break;
+    case ColWriteSize:
+      s << formatSize(estimate(entry.writeSize)).c_str();
+      break;
+    case ColReadSize:
+      s << formatSize(estimate(entry.readSize)).c_str();
+      break;
+    case ColWriteCount:
+      s << estimate(entry.writeCount);
+      break;
+    case ColReadCount:
+      s << estimate(entry.readCount);
+      break;
+    case ColWriteAvg:
+      s << formatSize(average(entry.writeSize, entry.writeCount)).c_str();
+      break;
+    case ColReadAvg:
+      s << formatSize(average(entry.readSize, entry.readCount)).c_str();
+      break;
+    case ColSmallOps:
+      s << smallOpsPercent(entry);
+      break;
+    case ColOpenCount:
+      s << estimate(entry.openCount);
+      break;
+    case ColCloseCount:
+      s << estimate(entry.closeCount);
+      break;
+    case ColOpenNow:
+      s << entry.openNow;
+      break;
+    case ColOpenAvg:
+      s << formatDuration(average(entry.lifetime, entry.lifetimeCount)).c_str();
+      break;
+    case ColOpenMax:
+      s << formatDuration(entry.lifetimeMax).c_str();
+      break;
+    case ColUnclosed:
+      s << entry.unclosedCount;
+      break;
+    case ColSyncCount:
+      s << estimate(entry.syncCount);
+      break;
+    case ColSyncTime:
+      s << formatDuration(estimate(entry.syncTime)).c_str();
+      break;
+    case ColSyncMax:
+      s << formatDuration(entry.syncMaxTime).c_str();
+      break;
+    case ColMapRead:
+      s << formatSize(entry.mapReadSize).c_str();
+      break;
+    case ColMapDirty:
+      s << formatSize(entry.mapDirtySize).c_str();
+      break;
+    case ColCached:
+      if (entry.cachedPercent < 0)
+        s << "-";
+      else
+        s << int(entry.cachedPercent);
+      break;
+    case ColSpecialEvents:
+      s << formatEvents(entry.specialEvents).c_str();
+      break;
+    case ColProcess:
+      s << entry.pid;
+      break;
+    case ColLastThread:
+      s << entry.lastThread;
+      break;
+    case ColLastAccess: {
+      char timeString[50];
+      std::tm tm;
+      std::time_t t = wallTime(entry.lastAccess);
+      localtime_r(&t, &tm);
+      std::strftime(timeString, sizeof(timeString), "%X", &tm);
+      s << conv.from_bytes(timeString);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+void Output::printDetails(const Entry &entry) {
+  auto &s = stream();
+  if (!printPrompt())
+    s << truncString(conv.from_bytes(entry.path), maxWidth(), true)
+      << std::endl;
+  auto summary = [&](const char *name, size_t total, size_t count,
+                     const SizeHistogram &hist) {
+    size_t small = std::accumulate(hist.cbegin(),
+                                   hist.cbegin() + smallSizeBuckets, size_t{0});
+    s << name << estimate(count) << " ops, "
+      << formatSize(estimate(total)).c_str() << " total, "
+      << formatSize(average(total, count)).c_str() << " avg, "
+      << (count ? small * 100 / count : 0) << "% under 4K" << std::endl;
+  };
+  const auto &hist = sizes(entry);
+  summary("write: ", entry.writeSize, entry.writeCount, hist.write);
+  summary("read:  ", entry.readSize, entry.readCount, hist.read);
+  bool mapped = entry.specialEvents & Entry::EventMapped;
+  if (mapped)
+    s << "mapped: " << formatSize(entry.mapReadSize).c_str()
+      << " read, " << formatSize(entry.mapDirtySize).c_str()
+      << " dirtied (estimated)" << std::endl;
+  auto used = [&](size_t i) { return hist.write[i] || hist.read[i]; };
+  size_t first = 0, last = sizeBuckets;
+  while (first < last && !used(first))
+    ++first;
+  while (last > first && !used(last - 1))
+    --last;
+  auto [begin, end] = linesRange();
+  size_t header = mapped ? 4 : 3;
+  size_t lines = end - begin > header ? end - begin - header : 0;
+  if (first < last) {
+    constexpr size_t fixedWidth{8 + 2 * 16};
+    size_t barWidth = maxWidth() > fixedWidth
+                          ? std::min<size_t>((maxWidth() - fixedWidth) / 2, 30)
+                          : 0;
+    s << std::setw(8) << "size" << std::setw(10) << "writes"
+      << std::setw(6 + barWidth) << "" << std::setw(10) << "reads"
+      << std::endl;
+    lines = lines ? lines - 1 : 0;
+    for (size_t i = first; i < last && lines; ++i, --lines)
+      printHistogramRow(i, entry, barWidth);
+  }
+  // Remaining lines list the stacks with the most bytes, then operations.
+  if (!entry.callSites || lines < 2)
+    return;
+  constexpr size_t fixedWidth{8 + 8 + 2};
+  s << std::setw(8) << "bytes" << std::setw(8) << "ops"
+    << "  call site" << std::endl;
+  for (const auto &ranked : topCallSites(&entry, lines - 1)) {
+    s << std::setw(8) << formatSize(estimate(ranked.site.bytes)).c_str()
+      << std::setw(8) << estimate(ranked.site.ops) << "  "
+      << truncString(conv.from_bytes(stackName(ranked.stack, " < ")),
+                     maxWidth() > fixedWidth ? maxWidth() - fixedWidth : 0,
+                     false)
+      << std::endl;
+  }
+}
+
+void Output::printHistogramRow(size_t bucket, const Entry &entry,
+                               size_t barWidth) {
+  auto &s = stream();
+  std::string label = bucket ? formatSize(size_t{1} << (bucket - 1)) : "0b";
+  if (bucket == sizeBuckets - 1)
+    label = ">=" + label;
+  s << std::setw(8) << label.c_str();
+  auto cell = [&](uint32_t n, size_t count) {
+    size_t pct = count ? n * 100 / count : 0;
+    s << std::setw(10) << estimate(n) << std::setw(4) << pct << "% ";
+    size_t bar = count ? (n * barWidth + count - 1) / count : 0;
+    s << std::left << std::setw(barWidth) << std::wstring(bar, L'#')
+      << std::right;
+  };
+  cell(sizes(entry).write[bucket], entry.writeCount);
+  cell(sizes(entry).read[bucket], entry.readCount);
   s << std::endl;
 }
 
 void Output::printColumnHeaders() {
   auto &s = stream();
-  if (visibleControlHints()) {
+  if (visibleControlHints() && !printPrompt()) {
     std::wstring ss;
     {
       std::lock_guard lck(mtxParams);
-      ss = L"[s]:" + std::to_wstring(static_cast<unsigned>(sorting)) +
+      ss = L"[s]:" + conv.from_bytes(columnNames[sorting]) +
            (reverseSorting ? L"-" : L"+") + L" [n]↓ [p]↑ [q]";
     }
     s << ss;
-    s << std::setw(idxWidth + colWidth[ColPath] - ss.size()) << "[0]";
-    for (size_t i = ColPath + 1; i < ColumnsCount; ++i)
-      s << std::setw(colWidth[i]) << (L"[" + std::to_wstring(i) + L"]");
+    size_t width = idxWidth + colWidth[ColPath];
+    s << std::setw(width > ss.size() ? width - ss.size() : 1) << "[0]";
+    for (size_t i = 1; i < shownColumns.size(); ++i)
+      s << std::setw(colWidth[shownColumns[i]])
+        << (i < 10 ? L"[" + std::to_wstring(i) + L"]" : L"");
     s << std::endl;
   }
   size_t cnt = count();
@@ -288,8 +864,8 @@ void Output::printColumnHeaders() {
   s << sCount;
   s << std::setw(idxWidth + colWidth[ColPath] - sCount.size())
     << columnNames[ColPath];
-  for (size_t i = ColPath + 1; i < ColumnsCount; ++i)
-    s << std::setw(colWidth[i]) << columnNames[i];
+  for (size_t i = 1; i < shownColumns.size(); ++i)
+    s << std::setw(colWidth[shownColumns[i]]) << columnNames[shownColumns[i]];
   s << std::endl;
 }
 
@@ -297,34 +873,439 @@ void Output::printProcessInfo() {
   constexpr size_t left{20};
   if (maxWidth() <= left)
     return;
-  stream() << std::setw(left) << "PID: " << pid << std::endl
-           << std::setw(left)
+  if (processes.size() > 1) {
+    std::wstring pids;
+    for (auto p : processes)
+      pids += (pids.empty() ? L"" : L" ") + std::to_wstring(p);
+    stream() << std::setw(left) << "PIDs: "
+             << truncString(pids, maxWidth() - left, false) << std::endl;
+  } else {
+    stream() << std::setw(left) << "PID: " << pid << std::endl;
+  }
+  stream() << std::setw(left)
            << "Command line: " << truncString(cmd, maxWidth() - left, false)
            << std::endl;
+  stream() << std::setw(left) << "Memory: " << formatSize(memoryUsage()).c_str()
+           << " RSS, " << list.size() << " entries";
+  if (evictedCount)
+    stream() << " (" << evictedCount << " evicted)";
+  if (stats && stats->degradation != Degradation::None) {
+    stream() << ", overloaded: "
+             << degradationNames[static_cast<int>(stats->degradation.load())];
+  }
+  stream() << std::endl;
+  printDiskIo();
+  if (samplePeriod.count())
+    printSamplingInfo();
+}
+
+void Output::printDiskIo() {
+  constexpr size_t left{20};
+  auto [readSize, writeSize, diskRead, diskWrite] = diskTotals();
+  auto percent = [this](size_t physical, size_t logical) {
+    auto ratio = diskRatio(physical, logical);
+    return ratio == "-" ? ratio : ratio + '%';
+  };
+  stream() << std::setw(left) << "Disk I/O: "
+           << "read " << formatSize(diskRead).c_str() << " of "
+           << formatSize(estimate(readSize)).c_str() << " ("
+           << percent(diskRead, readSize).c_str() << "), write "
+           << formatSize(diskWrite).c_str() << " of "
+           << formatSize(estimate(writeSize)).c_str() << " ("
+           << percent(diskWrite, writeSize).c_str() << ")" << std::endl;
+}
+
+std::string Output::diskRatio(size_t physical, size_t logical) const {
+  if (!estimate(logical))
+    return "-";
+  return std::to_string(physical * 100 / estimate(logical));
+}
+
+void Output::printReport(ReportFormat format, size_t top) {
+  {
+    std::lock_guard lck(mtxParams);
+    shownColumns = columns;
+  }
+  updateNonPathColsWidth();
+  updateScale();
+  if (format == ReportFormat::Json)
+    printJsonReport(top);
+  else
+    printTableReport(top);
+  present();
+}
+
+std::vector<const Output::Entry *> Output::topEntries(Column column,
+                                                      size_t top) {
+  {
+    std::lock_guard lck(mtxParams);
+    sorting = column;
+    reverseSorting = true;
+  }
+  sort();
+  std::vector<const Entry *> ret;
+  for (auto it = list.cbegin(); it != list.cend() && ret.size() < top; ++it) {
+    if (!it->filtered)
+      break;
+    ret.push_back(&*it);
+  }
+  return ret;
+}
+
+void Output::printTableReport(size_t top) {
+  constexpr size_t left{20};
+  auto &s = stream();
+  printProcessInfo();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  s << std::setw(left) << "Duration: " << std::fixed << std::setprecision(1)
+    << elapsed.count() << std::defaultfloat << " s" << std::endl;
+  auto totals = reportTotals();
+  s << std::setw(left) << "Totals: ";
+  for (size_t i = 0; i < eventTypes; ++i) {
+    s << (i ? ", " : "") << eventNames[i] << ' ' << estimate(totals.events[i]);
+    auto type = static_cast<Event>(i);
+    if (type == Event::Read)
+      s << " (" << formatSize(estimate(totals.readSize)).c_str() << ')';
+    else if (type == Event::Write)
+      s << " (" << formatSize(estimate(totals.writeSize)).c_str() << ')';
+    else if (type == Event::Sync)
+      s << " (" << formatDuration(estimate(totals.syncTime)).c_str() << ')';
+  }
+  s << std::endl;
+  if (stats) {
+    double cpu = totals.userCpu + totals.systemCpu;
+    s << std::setw(left) << "Tracer: " << stats->syscallStops
+      << " syscall stops, " << stats->events << " events, CPU " << std::fixed
+      << std::setprecision(2) << stats->cpuTime / 1e9 << " s tracer thread, "
+      << totals.userCpu << " s user + " << totals.systemCpu
+      << " s system total (" << std::setprecision(1)
+      << cpu * 100 / elapsed.count() << "% of duration)" << std::defaultfloat;
+    if (stats->degradationChanges) {
+      s << ", " << stats->degradationChanges
+        << " overload level changes, worst "
+        << degradationNames[static_cast<int>(stats->maxDegradation.load())];
+    }
+    s << std::endl;
+  }
+  for (auto col : shownColumns) {
+    if (!isMetric(col))
+      continue;
+    auto entries = topEntries(col, top);
+    s << std::endl << "Top " << entries.size() << " by " << columnNames[col]
+      << ':' << std::endl;
+    if (entries.empty())
+      continue;
+    size_t pathWidth{0};
+    for (auto e : entries)
+      pathWidth = std::max(pathWidth, displayLength(e->path));
+    colWidth[ColPath] = std::max(minPathColWidth, pathWidth);
+    setCount(entries.size());
+    printColumnHeaders();
+    for (size_t i = 0; i < entries.size(); ++i) {
+      printEntry(i + 1, *entries[i]);
+      s << std::endl;
+    }
+  }
+  if (symbolizer)
+    printCallSites(top);
 }
 
-std::tm Output::now() const {
-  auto time =
-      std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-  return *std::localtime(&time);
+void Output::printCallSites(size_t top) {
+  auto &s = stream();
+  symbolizer->flush();
+  auto sites = topCallSites(nullptr, top);
+  s << std::endl
+    << "Top " << sites.size() << " call sites by bytes:" << std::endl;
+  for (const auto &ranked : sites) {
+    s << std::setw(idxWidth + 5)
+      << formatSize(estimate(ranked.site.bytes)).c_str() << std::setw(10)
+      << estimate(ranked.site.ops) << " ops  "
+      << conv.from_bytes(ranked.entry->path) << std::endl
+      << std::setw(idxWidth + 21) << ""
+      << conv.from_bytes(stackName(ranked.stack, " < ")) << std::endl;
+  }
 }
 
-std::pair<Output::Entry &, bool> Output::getEntry(const std::string &path) {
-  auto [it, inserted] = hashmap.emplace(path, nullptr);
+void Output::printJsonCallSites(size_t top) {
+  auto &s = stream();
+  symbolizer->flush();
+  s << ",\n  \"call_sites\": [";
+  auto sites = topCallSites(nullptr, top);
+  for (size_t i = 0; i < sites.size(); ++i) {
+    const auto &ranked = sites[i];
+    s << (i ? ",\n    " : "\n    ")
+      << "{\"path\": " << conv.from_bytes(jsonString(ranked.entry->path))
+      << ", \"bytes\": " << estimate(ranked.site.bytes)
+      << ", \"ops\": " << estimate(ranked.site.ops) << ", \"stack\": [";
+    const auto &[tgid, addrs] = *stacks[ranked.stack];
+    for (size_t j = 0; j < addrs.size(); ++j)
+      s << (j ? ", " : "")
+        << conv.from_bytes(jsonString(symbolizer->name(tgid, addrs[j])));
+    s << "]}";
+  }
+  s << (sites.empty() ? "]" : "\n  ]");
+}
+
+void Output::printJsonReport(size_t top) {
+  auto &s = stream();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - startTime;
+  s << "{\n  \"pids\": [";
+  for (auto it = processes.cbegin(); it != processes.cend(); ++it)
+    s << (it == processes.cbegin() ? "" : ", ") << *it;
+  s << "],\n  \"command\": "
+    << conv.from_bytes(jsonString(conv.to_bytes(cmd))) << ",\n";
+  s << "  \"duration\": " << elapsed.count() << ",\n";
+  if (samplePeriod.count()) {
+    s << "  \"sampling\": {\"on_ms\": " << sampleOn.count()
+      << ", \"period_ms\": " << samplePeriod.count()
+      << ", \"traced_ratio\": " << 1 / scale << "},\n";
+  }
+  s << "  \"entries\": " << list.size() << ",\n  \"evicted\": " << evictedCount
+    << ",\n  \"totals\": {";
+  auto totals = reportTotals();
+  for (size_t i = 0; i < eventTypes; ++i)
+    s << '"' << eventNames[i] << "\": " << estimate(totals.events[i]) << ", ";
+  s << "\"read_bytes\": " << estimate(totals.readSize)
+    << ", \"write_bytes\": " << estimate(totals.writeSize)
+    << ", \"sync_ns\": " << estimate(totals.syncTime) << "},\n";
+  auto disk = diskTotals();
+  s << "  \"disk\": {\"file_read_bytes\": " << estimate(disk.readSize)
+    << ", \"file_write_bytes\": " << estimate(disk.writeSize)
+    << ", \"storage_read_bytes\": " << disk.diskRead
+    << ", \"storage_write_bytes\": " << disk.diskWrite << "},\n";
+  if (stats) {
+    s << "  \"tracer\": {\"syscall_stops\": " << stats->syscallStops
+      << ", \"events\": " << stats->events
+      << ", \"tracer_cpu\": " << stats->cpuTime / 1e9
+      << ", \"user_cpu\": " << totals.userCpu
+      << ", \"system_cpu\": " << totals.systemCpu
+      << ", \"overload_changes\": " << stats->degradationChanges
+      << ", \"worst_overload\": \""
+      << degradationNames[static_cast<int>(stats->maxDegradation.load())]
+      << "\"},\n";
+  }
+  s << "  \"top\": {";
+  bool first{true};
+  for (auto col : shownColumns) {
+    if (!isMetric(col))
+      continue;
+    s << (first ? "" : ",") << "\n    \"" << columnNames[col] << "\": [";
+    first = false;
+    auto entries = topEntries(col, top);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      s << (i ? ",\n      " : "\n      ");
+      printJsonEntry(*entries[i]);
+    }
+    s << (entries.empty() ? "]" : "\n    ]");
+  }
+  s << "\n  }";
+  if (symbolizer)
+    printJsonCallSites(top);
+  s << "\n}" << std::endl;
+}
+
+Output::DiskTotals Output::diskTotals() const {
+  DiskTotals totals;
+  for (const auto &[tid, thread] : threads) {
+    totals.readSize += thread.fileReadSize;
+    totals.writeSize += thread.fileWriteSize;
+    totals.diskRead += thread.sampled.readBytes;
+    totals.diskWrite += thread.sampled.writeBytes;
+  }
+  return totals;
+}
+
+Output::ReportTotals Output::reportTotals() const {
+  ReportTotals totals;
+  for (const auto &e : list) {
+    totals.readSize += e.readSize;
+    totals.writeSize += e.writeSize;
+    totals.syncTime += e.syncTime;
+  }
+  std::copy(eventCounts.cbegin(), eventCounts.cend(), totals.events.begin());
+  if (stats) {
+    for (size_t i = 0; i < eventTypes; ++i)
+      totals.events[i] += stats->unlistedEvents[i];
+    totals.readSize += stats->unlistedReadSize;
+    totals.writeSize += stats->unlistedWriteSize;
+  }
+  rusage ru{};
+  getrusage(RUSAGE_SELF, &ru);
+  totals.userCpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+  totals.systemCpu = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  return totals;
+}
+
+void Output::printJsonEntry(const Entry &entry) {
+  auto &s = stream();
+  s << "{\"path\": " << conv.from_bytes(jsonString(entry.path));
+  for (auto col : shownColumns) {
+    if (col == ColPath)
+      continue;
+    s << ", \"" << columnNames[col] << "\": ";
+    if (col == ColSpecialEvents)
+      s << '"' << formatEvents(entry.specialEvents).c_str() << '"';
+    else if (col == ColCached && entry.cachedPercent < 0)
+      s << "null";
+    else
+      s << columnValue(entry, col);
+  }
+  s << '}';
+}
+
+void Output::saveSnapshot() { makeSnapshot().save(snapshotPath.c_str()); }
+
+void Output::printSamplingInfo() {
+  constexpr size_t left{20};
+  stream() << std::setw(left) << "Sampling: " << sampleOn.count() << " of "
+           << samplePeriod.count() << " ms, " << std::fixed
+           << std::setprecision(1) << 100 / scale << std::defaultfloat
+           << "% traced, counters are estimates" << std::endl;
+}
+
+size_t Output::memoryUsage() const {
+  std::ifstream file("/proc/self/statm");
+  size_t pages{0}, rss{0};
+  if (!(file >> pages >> rss))
+    return 0;
+  return rss * sysconf(_SC_PAGESIZE);
+}
+
+void Output::updateNonPathColsWidth() {
+  nonPathColsWidth = std::accumulate(
+      shownColumns.cbegin(), shownColumns.cend(), idxWidth,
+      [this](size_t acc, Column c) { return acc + colWidth[c]; });
+}
+
+size_t Output::displayLength(const std::string &str) {
+  return std::count_if(str.cbegin(), str.cend(),
+                       [](char c) { return (c & 0xC0) != 0x80; });
+}
+
+std::string Output::jsonString(const std::string &str) {
+  std::string ret{'"'};
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ret += buf;
+    } else {
+      ret += c;
+    }
+  }
+  return ret + '"';
+}
+
+std::optional<size_t> Output::selection() const { return std::nullopt; }
+
+void Output::highlight(bool) {}
+
+void Output::resetSelection() {}
+
+Output::ThreadEntry &Output::getThread(pid_t tid, pid_t pid) {
+  auto [it, inserted] = threads.try_emplace(tid);
   if (inserted) {
-    list.emplace_back(Entry{conv.from_bytes(path)});
-    it->second = &list.back();
+    it->second.name = threadName(tid, pid);
+    it->second.pid = pid;
+    // Threads already gone keep the default track name.
+    if (timeline && it->second.name != L"?")
+      timeline->nameThread(tid, pid, conv.to_bytes(it->second.name));
+    if (auto base = MapSampler::readThreadCounters(tid, pid);
+        base && stats && base->startTime < stats->attachTime)
+      it->second.sampledBase = *base;
   }
-  return {*(it->second), inserted};
+  return it->second;
 }
 
-std::string Output::fixRelativePath(const std::string &path) {
-  std::string s(path);
-  while (regex_search(s, reCurrent))
-    s = regex_replace(s, reCurrent, "/");
-  while (regex_search(s, reParent))
-    s = regex_replace(s, reParent, "/");
-  return s;
+void Output::countThreadIo(const Entry &entry, const EventInfo &info) {
+  if (info.type != Event::Open && info.type != Event::Read &&
+      info.type != Event::Write)
+    return;
+  auto &thread = getThread(info.pid, info.tgid);
+  if (entry.path.front() == '/') {
+    if (info.type == Event::Read)
+      thread.fileReadSize += info.sizeArg;
+    else if (info.type == Event::Write)
+      thread.fileWriteSize += info.sizeArg;
+  }
+  IoCounters *io;
+  if (auto it = thread.files.find(&entry); it != thread.files.end()) {
+    io = &it->second;
+  } else if (threadFilesCount < maxThreadFiles) {
+    io = &thread.files[&entry];
+    ++threadFilesCount;
+  } else {
+    io = &thread.otherFiles;
+  }
+  switch (info.type) {
+  case Event::Open:
+    ++io->openCount;
+    break;
+  case Event::Read:
+    io->readCount += info.count;
+    io->readSize += info.sizeArg;
+    break;
+  case Event::Write:
+    io->writeCount += info.count;
+    io->writeSize += info.sizeArg;
+    break;
+  default:
+    break;
+  }
+}
+
+std::vector<Output::RankedCallSite>
+Output::topCallSites(const Entry *entry, size_t top) const {
+  std::vector<RankedCallSite> sites;
+  auto collect = [&sites](const Entry &e) {
+    if (e.callSites) {
+      for (const auto &[id, site] : *e.callSites)
+        sites.push_back({&e, id, site});
+    }
+  };
+  if (entry) {
+    collect(*entry);
+  } else {
+    for (const auto &e : list) {
+      if (e.filtered)
+        collect(e);
+    }
+  }
+  size_t n = std::min(top, sites.size());
+  std::partial_sort(sites.begin(), sites.begin() + n, sites.end(),
+                    [](const RankedCallSite &a, const RankedCallSite &b) {
+                      if (a.site.bytes != b.site.bytes)
+                        return a.site.bytes > b.site.bytes;
+                      return a.site.ops > b.site.ops;
+                    });
+  sites.resize(n);
+  return sites;
+}
+
+std::string Output::stackName(uint32_t id, const char *separator) const {
+  const auto &[tgid, addrs] = *stacks[id];
+  std::string name;
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    if (i)
+      name += separator;
+    name += symbolizer->name(tgid, addrs[i]);
+  }
+  return name;
+}
+
+std::wstring Output::threadName(pid_t tid, pid_t pid) {
+  std::string path = "/proc/" + std::to_string(pid) + "/task/" +
+                     std::to_string(tid) + "/comm";
+  std::string name;
+  std::ifstream file(path);
+  if (!file || !std::getline(file, name))
+    return L"?";
+  return conv.from_bytes(name);
 }
 
 std::wstring Output::truncString(const std::wstring &str, size_t maxSize,
@@ -356,6 +1337,19 @@ std::string Output::formatSize(size_t size) const {
   return buf;
 }
 
+std::string Output::formatDuration(uint64_t ns) const {
+  if (ns < 1000)
+    return std::to_string(ns) + "ns";
+  const char *suffixes[] = {"us", "ms", "s"};
+  double d = ns;
+  size_t i = 0;
+  while ((d /= 1000) >= 1000 && i < std::size(suffixes) - 1)
+    ++i;
+  char buf[9]{};
+  std::snprintf(buf, sizeof(buf), "%.1f%s", d, suffixes[i]);
+  return buf;
+}
+
 std::string Output::formatEvents(uint8_t events) const {
   std::string s;
   if (events & Entry::EventMapped)
@@ -370,11 +1364,11 @@ std::string Output::formatEvents(uint8_t events) const {
 }
 
 size_t Output::headerHeight() const {
-  return fixedHeaderHeight + visibleControlHints();
+  return fixedHeaderHeight + visibleControlHints() + !!samplePeriod.count();
 }
 
 FileOutput::FileOutput(const char *path, pid_t pid, const std::string &cmd,
-                       const std::string &filter, unsigned delay)
+                       std::shared_ptr<const Filter> filter, double delay)
     : Output(pid, cmd, filter, delay), file(path) {
   start();
 }
@@ -385,6 +1379,8 @@ std::wostream &FileOutput::stream() { return file; }
 
 void FileOutput::clear() { file.seekp(0); }
 
+void FileOutput::present() { file.flush(); }
+
 size_t FileOutput::maxWidth() const {
   return std::numeric_limits<size_t>::max();
 }
@@ -395,11 +1391,46 @@ std::pair<size_t, size_t> FileOutput::linesRange() const {
 
 bool FileOutput::visibleControlHints() const { return false; }
 
+ReportOutput::ReportOutput(const char *path, pid_t pid, const std::string &cmd,
+                           std::shared_ptr<const Filter> filter, double delay,
+                           ReportFormat format, size_t top)
+    : Output(pid, cmd, filter, delay), format(format), top(top) {
+  if (path)
+    file.open(path);
+  headless = true;
+  start();
+}
+
+ReportOutput::~ReportOutput() {
+  stop();
+  printReport(format, top);
+}
+
+std::wostream &ReportOutput::stream() {
+  return file.is_open() ? file : std::wcout;
+}
+
+void ReportOutput::clear() {}
+
+void ReportOutput::present() { stream().flush(); }
+
+size_t ReportOutput::maxWidth() const {
+  return std::numeric_limits<size_t>::max();
+}
+
+std::pair<size_t, size_t> ReportOutput::linesRange() const {
+  return {0, std::numeric_limits<size_t>::max()};
+}
+
+bool ReportOutput::visibleControlHints() const { return false; }
+
 size_t TerminalOutput::nCols;
 size_t TerminalOutput::nRows;
+volatile sig_atomic_t TerminalOutput::resized{1};
 
 TerminalOutput::TerminalOutput(pid_t pid, const std::string &cmd,
-                               const std::string &filter, unsigned delay)
+                               std::shared_ptr<const Filter> filter,
+                               double delay)
     : Output(pid, cmd, filter, delay) {
   signal(SIGWINCH, &TerminalOutput::sigwinchHandler);
   updateWindowSize();
@@ -408,7 +1439,10 @@ TerminalOutput::TerminalOutput(pid_t pid, const std::string &cmd,
 
 TerminalOutput::~TerminalOutput() { stop(); }
 
-void TerminalOutput::sigwinchHandler(int) { updateWindowSize(); }
+void TerminalOutput::sigwinchHandler(int) {
+  updateWindowSize();
+  resized = 1;
+}
 
 void TerminalOutput::updateWindowSize() {
   struct winsize ws;
@@ -421,26 +1455,87 @@ void TerminalOutput::pageDown() {
   size_t m = nRows + scrollDelta;
   size_t n = count() + headerHeight();
   if (m < n && nRows > headerHeight()) {
-    scrollDelta += std::min(nRows - headerHeight(), n - m);
+    size_t delta = std::min(pageHeight(), n - m);
+    scrollDelta += delta;
+    selected = std::min(selected + delta, count() - 1);
     requestUpdate();
   }
 }
 
 void TerminalOutput::pageUp() {
-  if (nRows > headerHeight()) {
-    size_t n = std::min(scrollDelta, nRows - headerHeight());
-    if (n) {
-      scrollDelta -= n;
-      requestUpdate();
-    }
+  size_t n = std::min(scrollDelta, pageHeight());
+  if (n) {
+    scrollDelta -= n;
+    selected -= n;
+    requestUpdate();
   }
 }
 
-std::wostream &TerminalOutput::stream() { return std::wcout; }
+void TerminalOutput::selectNext() {
+  if (selected + 1 >= count())
+    return;
+  if (++selected >= scrollDelta + pageHeight())
+    ++scrollDelta;
+  requestUpdate();
+}
+
+void TerminalOutput::selectPrev() {
+  if (!selected)
+    return;
+  if (--selected < scrollDelta)
+    --scrollDelta;
+  requestUpdate();
+}
+
+size_t TerminalOutput::pageHeight() const {
+  return nRows > headerHeight() ? nRows - headerHeight() : 0;
+}
+
+std::wostream &TerminalOutput::stream() { return frame; }
 
 void TerminalOutput::clear() {
-  escape("H");
-  escape("J");
+  frame.str({});
+  frame.clear();
+}
+
+void TerminalOutput::present() {
+  std::vector<std::wstring> lines;
+  std::wstring text = frame.str();
+  for (size_t pos = 0; pos < text.size();) {
+    size_t eol = std::min(text.find(L'\n', pos), text.size());
+    lines.emplace_back(text, pos, eol - pos);
+    pos = eol + 1;
+  }
+  lines.resize(std::min(lines.size(), nRows + 1));
+  std::wstring out;
+  if (resized) {
+    resized = 0;
+    screen.clear();
+    out += L"\033[H\033[J";
+  }
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (i < screen.size() && screen[i] == lines[i])
+      continue;
+    out += L"\033[" + std::to_wstring(i + 1) + L";1H\033[2K" + lines[i];
+  }
+  if (lines.size() < screen.size())
+    out += L"\033[" + std::to_wstring(lines.size() + 1) + L";1H\033[J";
+  screen = std::move(lines);
+  if (out.empty())
+    return;
+  // Park the cursor below the table so that log messages don't overwrite it.
+  out += L"\033[" + std::to_wstring(screen.size() + 1) + L";1H";
+  std::string bytes = conv.to_bytes(out);
+  for (size_t done = 0; done < bytes.size();) {
+    ssize_t n = write(STDOUT_FILENO, bytes.data() + done, bytes.size() - done);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      LOGPE("write");
+      return;
+    }
+    done += n;
+  }
 }
 
 size_t TerminalOutput::maxWidth() const { return nCols; }
@@ -452,3 +1547,9 @@ std::pair<size_t, size_t> TerminalOutput::linesRange() const {
 }
 
 bool TerminalOutput::visibleControlHints() const { return true; }
+
+std::optional<size_t> TerminalOutput::selection() const { return selected; }
+
+void TerminalOutput::highlight(bool on) { escape(on ? "7m" : "0m"); }
+
+void TerminalOutput::resetSelection() { selected = scrollDelta = 0; }
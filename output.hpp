@@ -1,7 +1,16 @@
 #pragma once
 
+#include "aggregator.hpp"
+#include "cachesampler.hpp"
 #include "column.hpp"
 #include "event.hpp"
+#include "filter.hpp"
+#include "mapsampler.hpp"
+#include "snapshot.hpp"
+#include "symbolizer.hpp"
+#include "timeline.hpp"
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <codecvt>
 #include <condition_variable>
@@ -9,24 +18,49 @@
 #include <ctime>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <list>
 #include <locale>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <regex>
+#include <set>
+#include <signal.h>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <sys/types.h>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
-class Output {
+class Output : public Aggregator {
 public:
-  Output(pid_t pid, const std::string &cmd, const std::string &filter,
-         unsigned delay);
+  enum class ReportFormat { Table, Json };
+  Output(pid_t pid, const std::string &cmd,
+         std::shared_ptr<const Filter> filter, double delay);
   virtual ~Output();
   void setSorting(Column column);
+  void setSortingIndex(size_t index);
+  void shiftSorting(int delta);
   void toggleSortingOrder();
+  void setColumns(const std::vector<Column> &columns);
+  void toggleDetails();
+  void toggleThreads();
+  void setFilter(std::shared_ptr<const Filter> filter);
+  std::shared_ptr<const Filter> currentFilter() const;
+  void setPrompt(const std::string &prompt);
+  // Saves the final statistics of every file to path when stopped.
+  void setSnapshot(const std::string &path);
+  // Writes every event taking at least minDuration nanoseconds to path as
+  // a Chrome trace.
+  void setTimeline(const std::string &path, uint64_t minDuration);
   void queueEvent(const EventInfo &event);
+  // Events queued or being processed.
+  size_t backlog() const;
 
 protected:
   void requestUpdate();
@@ -36,105 +70,226 @@ protected:
   size_t headerHeight() const;
   virtual std::wostream &stream() = 0;
   virtual void clear() = 0;
+  virtual void present() = 0;
   virtual size_t maxWidth() const = 0;
   virtual std::pair<size_t, size_t> linesRange() const = 0;
   virtual bool visibleControlHints() const = 0;
+  virtual std::optional<size_t> selection() const;
+  virtual void highlight(bool on);
+  virtual void resetSelection();
+  void printReport(ReportFormat format, size_t top);
+  std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
+  // Events are only aggregated, nothing is rendered until the report.
+  bool headless{false};
 
 private:
-  struct Entry {
-    enum {
-      EventMapped = (1 << 0),
-      EventUnlinked = (1 << 1),
-      EventRenamed = (1 << 2)
-    };
-    std::wstring path;
+  enum class View { Files, Threads };
+  struct RankedCallSite {
+    const Entry *entry;
+    uint32_t stack;
+    CallSite site;
+  };
+  struct ReportTotals {
+    // Including events only counted while degraded.
+    std::array<size_t, std::size(eventNames)> events{};
+    size_t readSize{0};
+    size_t writeSize{0};
+    uint64_t syncTime{0};
+    double userCpu{0};
+    double systemCpu{0};
+  };
+  // Logical file I/O from syscalls and physical I/O sampled from /proc.
+  struct DiskTotals {
+    size_t readSize{0};
+    size_t writeSize{0};
+    size_t diskRead{0};
+    size_t diskWrite{0};
+  };
+  struct IoCounters {
     size_t writeSize{0};
     size_t readSize{0};
     size_t writeCount{0};
     size_t readCount{0};
     size_t openCount{0};
-    size_t closeCount{0};
-    uint8_t specialEvents{0};
-    pid_t lastThread{0};
-    std::tm lastAccess{};
-    bool filtered{false};
+    void add(const IoCounters &other);
+  };
+  struct ThreadEntry {
+    std::wstring name;
+    pid_t pid{0};
+    // Read and write bytes of files, which may reach storage.
+    size_t fileReadSize{0};
+    size_t fileWriteSize{0};
+    // Major faults and storage I/O sampled from /proc; threads which
+    // started before the attach count from the values when first seen.
+    MapSampler::ThreadCounters sampled, sampledBase;
+    // Files evicted or beyond maxThreadFiles.
+    IoCounters otherFiles;
+    std::unordered_map<const Entry *, IoCounters> files;
   };
+  static constexpr size_t maxThreadFiles{100000};
+  static constexpr size_t cacheSampledFiles{32};
   static constexpr size_t idxWidth{5};
-  static constexpr size_t fixedHeaderHeight{3};
+  static constexpr size_t fixedHeaderHeight{5};
   static constexpr size_t minPathColWidth{20};
-  const std::regex reCurrent{R"(/\./)"};
-  const std::regex reParent{R"(/[^\./]+/\.\./)"};
-  size_t colWidth[ColumnsCount]{0, 7, 7, 7, 7, 7, 7, 5, 11, 12};
+  static constexpr size_t threadNameWidth{17};
+  static constexpr size_t filterChunkSize{16384};
+  size_t colWidth[ColumnsCount]{0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8,
+                                8, 9, 7, 8, 8, 7, 7, 8, 5, 8, 11, 12};
   size_t nonPathColsWidth;
   size_t maxPathWidth{0};
+  std::vector<Column> columns, shownColumns;
   Column sorting{ColPath};
   bool reverseSorting{false};
+  View view{View::Files}, shownView{View::Files};
+  bool details{false};
+  const Entry *detailed{nullptr};
+  pid_t detailedThread{0};
   pid_t pid{0};
-  std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
+  std::unique_ptr<MapSampler> mapSampler;
+  // Measures the top files by read size while the cached% column is shown.
+  std::unique_ptr<CacheSampler> cacheSampler;
+  std::chrono::time_point<std::chrono::steady_clock> lastMapSampleTime;
+  std::string snapshotPath;
   std::wstring cmd;
-  std::string filter;
+  std::shared_ptr<const Filter> pendingFilter;
+  std::wstring prompt;
   std::chrono::duration<double> delay;
   std::chrono::time_point<std::chrono::steady_clock> lastUpdateTime;
-  std::list<Entry> list;
-  size_t filteredCount{0};
-  std::unordered_map<std::string, Entry *> hashmap;
+  const std::chrono::time_point<std::chrono::steady_clock> startTime{
+      std::chrono::steady_clock::now()};
+  size_t filteredCount{0}, rowsCount{0};
+  std::unordered_map<pid_t, ThreadEntry> threads;
+  std::unique_ptr<Timeline> timeline;
+  size_t threadFilesCount{0};
   std::queue<EventInfo> eventsQueue;
+  std::atomic<size_t> processedBatch{0};
   bool updateReqEvent{false}, terminateReqEvent{false};
-  mutable std::mutex mtxEvents, mtxParams, mtxCount;
+  mutable std::mutex mtxEvents, mtxCount;
   std::condition_variable cv;
   std::thread thread;
   void threadRoutine();
   void update(bool recollect);
+  void render(bool recollect);
+  void setCount(size_t count);
   void sort();
+  void printFiles(bool showDetails);
+  void printThreads(bool showDetails);
+  void printThreadFiles(pid_t tid, const ThreadEntry &thread);
+  void printIoCounters(const IoCounters &io);
+  // Totals of the files passing the filter, like the files view shows.
+  IoCounters threadIo(const ThreadEntry &thread, size_t *files) const;
   void printEntry(size_t index, const Entry &entry);
+  void printDetails(const Entry &entry);
+  void printHistogramRow(size_t bucket, const Entry &entry, size_t barWidth);
+  void printCallSites(size_t top);
+  void printJsonCallSites(size_t top);
   void printProcessInfo();
+  void printSamplingInfo();
+  void printDiskIo();
+  std::string diskRatio(size_t physical, size_t logical) const;
+  void printTableReport(size_t top);
+  void printJsonReport(size_t top);
+  void printJsonEntry(const Entry &entry);
+  void saveSnapshot();
+  ReportTotals reportTotals() const;
+  DiskTotals diskTotals() const;
+  std::vector<const Entry *> topEntries(Column column, size_t top);
   void printColumnHeaders();
   void processEvents();
-  std::pair<Entry &, bool> getEntry(const std::string &path);
-  std::tm now() const;
+  bool collectMapSamples();
+  bool collectCacheSamples();
+  void applyFilter();
+  bool printPrompt();
+  size_t memoryUsage() const;
+  ThreadEntry &getThread(pid_t tid, pid_t pid);
+  void countThreadIo(const Entry &entry, const EventInfo &info);
+  // Moves the thread counters of evicted files to their other files.
+  virtual void onEvict(const std::unordered_set<const Entry *> &victims,
+                       Entry &evicted) override;
+  // Top call sites of an entry, or of all filtered entries if null.
+  std::vector<RankedCallSite> topCallSites(const Entry *entry,
+                                           size_t top) const;
+  std::string stackName(uint32_t id, const char *separator) const;
+  std::wstring threadName(pid_t tid, pid_t pid);
+  void updateNonPathColsWidth();
+  static size_t displayLength(const std::string &str);
+  static std::string jsonString(const std::string &str);
   std::wstring truncString(const std::wstring &str, size_t maxSize,
                            bool left) const;
   std::string formatSize(size_t size) const;
+  std::string formatDuration(uint64_t ns) const;
   std::string formatEvents(uint8_t state) const;
-  std::string fixRelativePath(const std::string &path);
 };
 
 class FileOutput : public Output {
 public:
   FileOutput(const char *path, pid_t pid, const std::string &cmd,
-             const std::string &filter, unsigned delay);
+             std::shared_ptr<const Filter> filter, double delay);
   virtual ~FileOutput();
 
 protected:
   virtual std::wostream &stream() override;
   virtual void clear() override;
+  virtual void present() override;
+  virtual size_t maxWidth() const override;
+  virtual std::pair<size_t, size_t> linesRange() const override;
+  virtual bool visibleControlHints() const override;
+
+private:
+  std::wofstream file;
+};
+
+class ReportOutput : public Output {
+public:
+  ReportOutput(const char *path, pid_t pid, const std::string &cmd,
+               std::shared_ptr<const Filter> filter, double delay,
+               ReportFormat format, size_t top);
+  virtual ~ReportOutput();
+
+protected:
+  virtual std::wostream &stream() override;
+  virtual void clear() override;
+  virtual void present() override;
   virtual size_t maxWidth() const override;
   virtual std::pair<size_t, size_t> linesRange() const override;
   virtual bool visibleControlHints() const override;
 
 private:
   std::wofstream file;
+  ReportFormat format;
+  size_t top;
 };
 
 class TerminalOutput : public Output {
 public:
-  TerminalOutput(pid_t pid, const std::string &cmd, const std::string &filter,
-                 unsigned delay);
+  TerminalOutput(pid_t pid, const std::string &cmd,
+                 std::shared_ptr<const Filter> filter, double delay);
   virtual ~TerminalOutput();
   void pageUp();
   void pageDown();
+  void selectPrev();
+  void selectNext();
 
 protected:
   virtual std::wostream &stream() override;
   virtual void clear() override;
+  virtual void present() override;
   virtual size_t maxWidth() const override;
   virtual std::pair<size_t, size_t> linesRange() const override;
   virtual bool visibleControlHints() const override;
+  virtual std::optional<size_t> selection() const override;
+  virtual void highlight(bool on) override;
+  virtual void resetSelection() override;
 
 private:
   static size_t nCols;
   static size_t nRows;
+  static volatile sig_atomic_t resized;
+  std::wostringstream frame;
+  std::vector<std::wstring> screen;
   size_t scrollDelta{0};
+  size_t selected{0};
+  size_t pageHeight() const;
   void escape(const char *cmd);
   static void updateWindowSize();
   static void sigwinchHandler(int);
@@ -0,0 +1,181 @@
+#include "session.hpp"
+#include "aggregator.hpp"
+#include "tracer.hpp"
+#include <iterator>
+
+// Events are only accounted by the aggregation thread.
+class Session::Aggregation : public Aggregator {
+public:
+  using Aggregator::Aggregator;
+  using Aggregator::evictEntries;
+  using Aggregator::process;
+};
+
+Session::Session(std::vector<std::string> argv) : argv(std::move(argv)) {}
+
+Session::Session(std::vector<pid_t> pids, std::string cgroup)
+    : pids(std::move(pids)), cgroup(std::move(cgroup)) {}
+
+Session::~Session() {
+  stop();
+  wait();
+}
+
+void Session::setFilter(std::shared_ptr<const Filter> f) { filter = f; }
+
+void Session::setSplitPids(bool split) { splitPids = split; }
+
+void Session::setPublishInterval(std::chrono::milliseconds interval) {
+  publishInterval = interval;
+}
+
+void Session::setMaxEntries(size_t count) { maxEntries = count; }
+
+void Session::addConsumer(BatchConsumer consumer) {
+  consumers.push_back(std::move(consumer));
+}
+
+bool Session::start() {
+  std::unique_lock lck(mtx);
+  if (state != State::Idle)
+    return false;
+  aggregation = std::make_unique<Aggregation>(filter);
+  aggregation->setSplitPids(splitPids);
+  aggregation->setMaxEntries(maxEntries);
+  state = State::Starting;
+  // Tracees are only traced by the thread which attached or spawned them.
+  tracerThread = std::thread(&Session::tracerRoutine, this);
+  cv.wait(lck, [this] { return state != State::Starting; });
+  if (state == State::Done)
+    return false;
+  aggregation->setStats(stats);
+  aggregationThread = std::thread(&Session::aggregationRoutine, this);
+  return true;
+}
+
+void Session::stop() {
+  // The tracer is only destroyed once it is no longer active.
+  std::lock_guard lck(mtx);
+  stopReq = true;
+  if (activeTracer)
+    activeTracer->stop();
+}
+
+bool Session::wait() {
+  if (tracerThread.joinable())
+    tracerThread.join();
+  if (aggregationThread.joinable())
+    aggregationThread.join();
+  std::lock_guard lck(mtx);
+  return success;
+}
+
+std::shared_ptr<const Snapshot> Session::snapshot() const {
+  std::lock_guard lck(mtx);
+  return aggregation ? aggregation->snapshot() : nullptr;
+}
+
+std::shared_ptr<const TracerStats> Session::statistics() const {
+  std::lock_guard lck(mtx);
+  return stats;
+}
+
+void Session::tracerRoutine() {
+  std::unique_ptr<Tracer> tracer;
+  if (!argv.empty()) {
+    std::vector<char *> args;
+    for (auto &arg : argv)
+      args.push_back(arg.data());
+    args.push_back(nullptr);
+    tracer = std::make_unique<Tracer>(args.data());
+  } else {
+    tracer = std::make_unique<Tracer>(pids, cgroup);
+  }
+  bool traced = *tracer;
+  {
+    std::lock_guard lck(mtx);
+    stats = tracer->statistics();
+    state = traced ? State::Tracing : State::Done;
+    if (traced)
+      activeTracer = tracer.get();
+    // Stopped while attaching or spawning.
+    if (traced && stopReq)
+      tracer->stop();
+  }
+  cv.notify_all();
+  if (!traced)
+    return;
+  tracer->setFilter(filter);
+  tracer->setOutputCallback([this](const EventInfo &info) {
+    pending.push_back(info);
+    if (pending.size() >= handOffSize)
+      handOff();
+  });
+  tracer->setTickCallback([this] { handOff(); });
+  tracer->setBacklogCallback([this] {
+    std::lock_guard lck(mtxBatch);
+    return pending.size() + batch.size() + backlog;
+  });
+  bool ok = tracer->loop();
+  handOff();
+  {
+    std::lock_guard lck(mtx);
+    success = ok;
+    state = State::Done;
+    activeTracer = nullptr;
+  }
+  cv.notify_all();
+  {
+    std::lock_guard lck(mtxBatch);
+    tracingDone = true;
+  }
+  cvBatch.notify_one();
+}
+
+void Session::handOff() {
+  if (pending.empty())
+    return;
+  bool wake;
+  {
+    std::lock_guard lck(mtxBatch);
+    wake = batch.empty();
+    if (wake)
+      std::swap(batch, pending);
+    else
+      batch.insert(batch.end(), std::make_move_iterator(pending.begin()),
+                   std::make_move_iterator(pending.end()));
+  }
+  pending.clear();
+  if (wake)
+    cvBatch.notify_one();
+}
+
+void Session::aggregationRoutine() {
+  auto lastPublish = std::chrono::steady_clock::now();
+  for (bool done = false; !done;) {
+    std::vector<EventInfo> events;
+    {
+      std::unique_lock lck(mtxBatch);
+      cvBatch.wait_until(lck, lastPublish + publishInterval,
+                         [this] { return !batch.empty() || tracingDone; });
+      std::swap(events, batch);
+      backlog = events.size();
+      // Events queued before the end are still aggregated.
+      done = tracingDone && events.empty();
+    }
+    if (!events.empty()) {
+      for (auto &consumer : consumers)
+        consumer(events);
+      for (auto &info : events)
+        aggregation->process(info);
+      aggregation->evictEntries();
+      std::lock_guard lck(mtxBatch);
+      backlog = 0;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (done || now - lastPublish >= publishInterval) {
+      aggregation->publish();
+      lastPublish = now;
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "event.hpp"
+#include "filter.hpp"
+#include "snapshot.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+class Aggregator;
+class Tracer;
+
+// Tracing session of libpsfiles: traces a spawned command or attached
+// processes in a background thread and aggregates their file I/O like the
+// psfiles tool does. Consumers get the traced events in batches, and the
+// aggregated statistics are pulled as snapshots published periodically.
+// Setters are only effective before start(). Sessions may run
+// concurrently; their tracer threads are interrupted with SIGRTMAX, other
+// signal handlers of the process are left alone.
+class Session {
+public:
+  using BatchConsumer = std::function<void(const std::vector<EventInfo> &)>;
+  // Spawns the command line argv.
+  Session(std::vector<std::string> argv);
+  // Attaches to processes and to the members of a cgroup, if not empty.
+  Session(std::vector<pid_t> pids, std::string cgroup = {});
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+  // Stops the session and waits for it.
+  ~Session();
+  void setFilter(std::shared_ptr<const Filter> filter);
+  void setSplitPids(bool split);
+  void setPublishInterval(std::chrono::milliseconds interval);
+  // Keeps statistics for at most count files, zero for no limit; least
+  // recently used files are merged into the *EVICTED* entry.
+  void setMaxEntries(size_t count);
+  // Called from the aggregation thread with the events received since the
+  // previous batch, before they are aggregated.
+  void addConsumer(BatchConsumer consumer);
+  // Starts tracing; false if the tracee could not be spawned or attached.
+  bool start();
+  void stop();
+  // Waits until the tracees exit or the session is stopped; false if
+  // tracing failed.
+  bool wait();
+  // Last published statistics, shared with the session rather than copied;
+  // null until the first publication.
+  std::shared_ptr<const Snapshot> snapshot() const;
+  // Tracer counters, null until started.
+  std::shared_ptr<const TracerStats> statistics() const;
+
+private:
+  class Aggregation;
+  std::vector<std::string> argv;
+  std::vector<pid_t> pids;
+  std::string cgroup;
+  std::shared_ptr<const Filter> filter{std::make_shared<const Filter>()};
+  bool splitPids{false};
+  size_t maxEntries{0};
+  std::chrono::milliseconds publishInterval{1000};
+  std::vector<BatchConsumer> consumers;
+  std::unique_ptr<Aggregation> aggregation;
+  // Owned by the tracer thread, set while it traces.
+  Tracer *activeTracer{nullptr};
+  std::shared_ptr<const TracerStats> stats;
+  enum class State { Idle, Starting, Tracing, Done };
+  State state{State::Idle};
+  bool stopReq{false}, success{false};
+  mutable std::mutex mtx;
+  std::condition_variable cv;
+  // Events are collected by the tracer thread and handed over in chunks of
+  // handOffSize or on its ticks to the queue, under a mutex of its own; the
+  // aggregation thread is only woken when the queue was empty.
+  static constexpr size_t handOffSize{4096};
+  std::vector<EventInfo> pending, batch;
+  size_t backlog{0};
+  bool tracingDone{false};
+  std::mutex mtxBatch;
+  std::condition_variable cvBatch;
+  std::thread tracerThread, aggregationThread;
+  void tracerRoutine();
+  void handOff();
+  void aggregationRoutine();
+};
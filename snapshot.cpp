@@ -0,0 +1,283 @@
+#include "snapshot.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+
+namespace {
+struct Header {
+  char magic[8];
+  uint32_t columns;
+  uint32_t reserved;
+  uint64_t rows;
+  uint64_t pathBytes;
+};
+
+template <typename T> void writeRaw(std::ostream &s, const T *data, size_t n) {
+  s.write(reinterpret_cast<const char *>(data), n * sizeof(T));
+}
+
+template <typename T> bool readRaw(std::istream &s, T *data, size_t n) {
+  return bool(s.read(reinterpret_cast<char *>(data), n * sizeof(T)));
+}
+
+// Increases of these columns are improvements.
+bool higherIsBetter(Column column) { return column == ColCached; }
+
+// Sums of these columns over files are meaningless.
+bool isAdditive(Column column) {
+  switch (column) {
+  case ColWriteAvg:
+  case ColReadAvg:
+  case ColSmallOps:
+  case ColOpenAvg:
+  case ColOpenMax:
+  case ColSyncMax:
+  case ColCached:
+    return false;
+  default:
+    return true;
+  }
+}
+
+std::string formatChange(int64_t before, int64_t after) {
+  std::ostringstream s;
+  s << std::showpos << after - before << std::noshowpos;
+  if (before)
+    s << " (" << std::showpos << std::fixed << std::setprecision(1)
+      << (after - before) * 100.0 / before << "%)";
+  return s.str();
+}
+} // namespace
+
+Snapshot::Snapshot(std::vector<std::string> columns)
+    : columnNames(std::move(columns)), values(columnNames.size()) {}
+
+Snapshot::Snapshot(const char *path) { success = load(path); }
+
+void Snapshot::add(std::string_view path, const std::vector<int64_t> &row) {
+  if (size() && path < this->path(size() - 1))
+    sorted = false;
+  pathData.append(path);
+  pathOffsets.push_back(pathData.size());
+  for (size_t i = 0; i < values.size(); ++i)
+    values[i].push_back(i < row.size() ? row[i] : 0);
+}
+
+bool Snapshot::save(const char *path) {
+  sortByPath();
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    LOGE("Failed to create snapshot #.", path);
+    return false;
+  }
+  Header header{};
+  std::copy(std::begin(magic), std::end(magic), header.magic);
+  header.columns = columnNames.size();
+  header.rows = size();
+  header.pathBytes = pathData.size();
+  writeRaw(file, &header, 1);
+  for (const auto &name : columnNames) {
+    uint32_t len = name.size();
+    writeRaw(file, &len, 1);
+    file.write(name.data(), len);
+  }
+  writeRaw(file, pathOffsets.data(), pathOffsets.size());
+  file.write(pathData.data(), pathData.size());
+  for (const auto &column : values)
+    writeRaw(file, column.data(), column.size());
+  if (!file.flush()) {
+    LOGE("Failed to write snapshot #.", path);
+    return false;
+  }
+  return true;
+}
+
+bool Snapshot::load(const char *path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    LOGE("Failed to open snapshot #.", path);
+    return false;
+  }
+  uint64_t fileSize = file.tellg();
+  file.seekg(0);
+  Header header;
+  if (!readRaw(file, &header, 1) ||
+      !std::equal(std::begin(magic), std::end(magic), header.magic)) {
+    LOGE("Not a psfiles snapshot: #.", path);
+    return false;
+  }
+  // Sizes are checked against the file before anything is allocated.
+  if (header.rows >= fileSize / sizeof(uint64_t) ||
+      header.pathBytes > fileSize ||
+      header.columns > fileSize / sizeof(int64_t) / (header.rows + 1) ||
+      (header.rows + 1) * sizeof(uint64_t) + header.pathBytes +
+              header.columns * header.rows * sizeof(int64_t) >
+          fileSize) {
+    LOGE("Truncated snapshot #.", path);
+    return false;
+  }
+  columnNames.resize(header.columns);
+  for (auto &name : columnNames) {
+    uint32_t len;
+    if (!readRaw(file, &len, 1) || len > fileSize) {
+      LOGE("Truncated snapshot #.", path);
+      return false;
+    }
+    name.resize(len);
+    readRaw(file, name.data(), len);
+  }
+  pathOffsets.resize(header.rows + 1);
+  pathData.resize(header.pathBytes);
+  values.assign(header.columns, std::vector<int64_t>(header.rows));
+  bool ok = readRaw(file, pathOffsets.data(), pathOffsets.size()) &&
+            readRaw(file, pathData.data(), pathData.size());
+  for (auto &column : values)
+    ok = ok && readRaw(file, column.data(), column.size());
+  ok = ok && pathOffsets.front() == 0 && pathOffsets.back() == pathData.size();
+  for (size_t i = 0; ok && i < size(); ++i) {
+    ok = pathOffsets[i] <= pathOffsets[i + 1];
+    // The diff relies on the order.
+    ok = ok && (!i || this->path(i - 1) < this->path(i));
+  }
+  if (!ok) {
+    LOGE("Corrupted snapshot #.", path);
+    return false;
+  }
+  return true;
+}
+
+void Snapshot::sortByPath() {
+  if (sorted)
+    return;
+  std::vector<size_t> order(size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [this](size_t a, size_t b) { return path(a) < path(b); });
+  std::string data;
+  data.reserve(pathData.size());
+  std::vector<uint64_t> offsets{0};
+  offsets.reserve(pathOffsets.size());
+  for (size_t row : order) {
+    data.append(path(row));
+    offsets.push_back(data.size());
+  }
+  for (auto &column : values) {
+    std::vector<int64_t> reordered;
+    reordered.reserve(column.size());
+    for (size_t row : order)
+      reordered.push_back(column[row]);
+    column = std::move(reordered);
+  }
+  pathData = std::move(data);
+  pathOffsets = std::move(offsets);
+  sorted = true;
+}
+
+size_t Snapshot::size() const { return pathOffsets.size() - 1; }
+
+const std::vector<std::string> &Snapshot::columns() const {
+  return columnNames;
+}
+
+std::string_view Snapshot::path(size_t row) const {
+  return std::string_view(pathData)
+      .substr(pathOffsets[row], pathOffsets[row + 1] - pathOffsets[row]);
+}
+
+int64_t Snapshot::value(size_t column, size_t row) const {
+  return values[column][row];
+}
+
+Snapshot::operator bool() const { return success; }
+
+void printSnapshotDiff(const Snapshot &before, const Snapshot &after,
+                       const std::vector<Column> &columns, size_t top,
+                       std::ostream &s) {
+  // Both path lists are sorted, one merge pass joins them. Rows missing
+  // from one side are npos there and count as zero.
+  constexpr size_t npos{size_t(-1)};
+  std::vector<std::pair<size_t, size_t>> rows;
+  rows.reserve(std::max(before.size(), after.size()));
+  size_t common{0};
+  for (size_t i = 0, j = 0; i < before.size() || j < after.size();) {
+    if (j == after.size() ||
+        (i < before.size() && before.path(i) < after.path(j))) {
+      rows.emplace_back(i++, npos);
+    } else if (i == before.size() || after.path(j) < before.path(i)) {
+      rows.emplace_back(npos, j++);
+    } else {
+      rows.emplace_back(i++, j++);
+      ++common;
+    }
+  }
+  s << "Before: " << before.size() << " files, after: " << after.size()
+    << " files, " << common << " in both" << std::endl;
+
+  auto columnIndex = [](const Snapshot &snap, Column col) {
+    auto beg = snap.columns().cbegin(), end = snap.columns().cend();
+    auto it = std::find(beg, end, columnNames[col]);
+    return it == end ? npos : size_t(std::distance(beg, it));
+  };
+  auto rowPath = [&](const std::pair<size_t, size_t> &row) {
+    return row.first != npos ? before.path(row.first) : after.path(row.second);
+  };
+  for (auto col : columns) {
+    if (!isMetric(col))
+      continue;
+    size_t colBefore = columnIndex(before, col);
+    size_t colAfter = columnIndex(after, col);
+    if (colBefore == npos || colAfter == npos) {
+      LOGW("Column # is missing from a snapshot.", columnNames[col]);
+      continue;
+    }
+    // Deltas are signed so that positive ones are regressions.
+    int sign = higherIsBetter(col) ? -1 : 1;
+    std::vector<std::pair<int64_t, size_t>> deltas;
+    int64_t totalBefore{0}, totalAfter{0};
+    for (size_t r = 0; r < rows.size(); ++r) {
+      auto [i, j] = rows[r];
+      int64_t a = i != npos ? before.value(colBefore, i) : 0;
+      int64_t b = j != npos ? after.value(colAfter, j) : 0;
+      // Unmeasured values are negative.
+      if (a < 0 || b < 0)
+        continue;
+      totalBefore += a;
+      totalAfter += b;
+      if (a != b)
+        deltas.emplace_back(sign * (b - a), r);
+    }
+    s << std::endl << columnNames[col];
+    if (isAdditive(col))
+      s << ": " << totalBefore << " -> " << totalAfter << ' '
+        << formatChange(totalBefore, totalAfter);
+    s << std::endl;
+    // Regressions have positive deltas, improvements negative ones.
+    auto printTop = [&](const char *title, int direction) {
+      size_t n = std::min(top, deltas.size());
+      std::partial_sort(deltas.begin(), deltas.begin() + n, deltas.end(),
+                        [direction](const auto &x, const auto &y) {
+                          return x.first * direction > y.first * direction;
+                        });
+      for (size_t k = 0; k < n && deltas[k].first * direction > 0; ++k) {
+        auto [i, j] = rows[deltas[k].second];
+        int64_t a = i != npos ? before.value(colBefore, i) : 0;
+        int64_t b = j != npos ? after.value(colAfter, j) : 0;
+        if (!k)
+          s << "  " << title << ':' << std::endl;
+        s << "    " << std::setw(12) << a << " -> " << std::left
+          << std::setw(12) << b << std::setw(24) << formatChange(a, b)
+          << std::right << rowPath(rows[deltas[k].second]);
+        if (i == npos || j == npos)
+          s << (i == npos ? " (new)" : " (gone)");
+        s << std::endl;
+      }
+    };
+    printTop("Regressions", 1);
+    printTop("Improvements", -1);
+  }
+}
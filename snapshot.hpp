@@ -0,0 +1,47 @@
+#pragma once
+
+#include "column.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Per-file column values of a run, saved in a columnar binary file and
+// compared with another run by `psfiles diff`. Paths are interned in one
+// buffer and kept sorted, so that two snapshots are joined by a single
+// merge pass. Integers are stored in host byte order.
+class Snapshot {
+public:
+  // Empty snapshot of the named columns, filled with add().
+  Snapshot(std::vector<std::string> columns);
+  // Snapshot loaded from a file.
+  Snapshot(const char *path);
+  void add(std::string_view path, const std::vector<int64_t> &values);
+  bool save(const char *path);
+  size_t size() const;
+  const std::vector<std::string> &columns() const;
+  std::string_view path(size_t row) const;
+  int64_t value(size_t column, size_t row) const;
+  operator bool() const;
+
+private:
+  static constexpr char magic[8]{'P', 'S', 'F', 'S', 'N', 'A', 'P', '1'};
+  std::vector<std::string> columnNames;
+  std::string pathData;
+  // Start of each path in pathData, followed by the end of the last one.
+  std::vector<uint64_t> pathOffsets{0};
+  // One vector per column, indexed by row.
+  std::vector<std::vector<int64_t>> values;
+  bool sorted{true};
+  bool success{true};
+  void sortByPath();
+  bool load(const char *path);
+};
+
+// Joins two snapshots on path and prints, for each metric column, the
+// files whose values grew or shrank the most.
+void printSnapshotDiff(const Snapshot &before, const Snapshot &after,
+                       const std::vector<Column> &columns, size_t top,
+                       std::ostream &s);
@@ -0,0 +1,127 @@
+#include "sockets.hpp"
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <netinet/in.h>
+#include <sstream>
+
+static uint32_t parseHex(std::string_view s) {
+  uint32_t val{0};
+  std::from_chars(s.data(), s.data() + s.size(), val, 16);
+  return val;
+}
+
+// Formats an "ADDR:PORT" field of /proc/net/tcp* where the address words
+// are printed in host byte order.
+static std::string inetAddress(const std::string &field, bool v6) {
+  size_t colon = field.find(':');
+  if (colon == std::string::npos)
+    return {};
+  std::string_view addr(field.data(), colon);
+  uint32_t port = parseHex(std::string_view(field).substr(colon + 1));
+  char buf[INET6_ADDRSTRLEN]{};
+  const char *format = "%s:%u";
+  if (v6 && addr.size() == 32) {
+    in6_addr a;
+    for (size_t i = 0; i < 4; ++i) {
+      uint32_t word = parseHex(addr.substr(i * 8, 8));
+      memcpy(a.s6_addr + i * 4, &word, sizeof(word));
+    }
+    inet_ntop(AF_INET6, &a, buf, sizeof(buf));
+    format = "[%s]:%u";
+  } else {
+    in_addr a;
+    a.s_addr = parseHex(addr);
+    inet_ntop(AF_INET, &a, buf, sizeof(buf));
+  }
+  // Formatted rather than concatenated, which GCC 12 flags with -Wrestrict
+  // in optimized builds.
+  char ret[sizeof(buf) + 8];
+  snprintf(ret, sizeof(ret), format, buf, port);
+  return ret;
+}
+
+std::string SocketResolver::name(pid_t pid, const std::string &link,
+                                 uint64_t now) {
+  uint64_t inode = socketInode(link);
+  if (!inode)
+    return link;
+  if (auto it = cache.find(inode); it != cache.end())
+    return it->second;
+  // Sockets created since the last scan are named on a later event.
+  if (lastScan && now - lastScan < rescanInterval)
+    return link;
+  lastScan = now;
+  scan(pid);
+  return cache.try_emplace(inode, link).first->second;
+}
+
+bool SocketResolver::pending(const std::string &name) const {
+  uint64_t inode = socketInode(name);
+  return inode && !cache.contains(inode);
+}
+
+uint64_t SocketResolver::socketInode(const std::string &link) {
+  static const std::string prefix{"socket:["};
+  if (!link.starts_with(prefix) || link.back() != ']')
+    return 0;
+  uint64_t inode{0};
+  std::from_chars(link.data() + prefix.size(), link.data() + link.size() - 1,
+                  inode);
+  return inode;
+}
+
+void SocketResolver::scan(pid_t pid) {
+  // Closed sockets are not removed one by one, the cache is bounded.
+  if (cache.size() > maxCached)
+    cache.clear();
+  scanInet(pid, "tcp", false);
+  scanInet(pid, "tcp6", true);
+  scanInet(pid, "udp", false);
+  scanInet(pid, "udp6", true);
+  scanUnix(pid);
+}
+
+void SocketResolver::scanInet(pid_t pid, const char *table, bool v6) {
+  std::ifstream file("/proc/" + std::to_string(pid) + "/net/" + table);
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string sl, local, remote, skip;
+    uint64_t inode{0};
+    fields >> sl >> local >> remote;
+    for (int i = 0; i < 6; ++i)
+      fields >> skip;
+    fields >> inode;
+    if (!fields || !inode || cache.contains(inode))
+      continue;
+    std::string proto = v6 ? std::string(table, strlen(table) - 1) : table;
+    std::string name = proto + ":" + inetAddress(local, v6);
+    // Listening and unconnected sockets have no peer.
+    if (remote.find_first_not_of("0:") != std::string::npos)
+      name += "->" + inetAddress(remote, v6);
+    cache.emplace(inode, std::move(name));
+  }
+}
+
+void SocketResolver::scanUnix(pid_t pid) {
+  std::ifstream file("/proc/" + std::to_string(pid) + "/net/unix");
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string skip, path;
+    uint64_t inode{0};
+    for (int i = 0; i < 6; ++i)
+      fields >> skip;
+    fields >> inode >> path;
+    if (!inode || cache.contains(inode))
+      continue;
+    cache.emplace(inode, path.empty()
+                             ? "unix:[" + std::to_string(inode) + "]"
+                             : "unix:" + path);
+  }
+}
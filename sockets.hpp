@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+// Names sockets by their addresses from /proc/<pid>/net tables, e.g.
+// "tcp:127.0.0.1:8080->127.0.0.1:41236" or "unix:/run/app.sock".
+// Resolved sockets are cached by inode; the tables of a process are read
+// again on a cache miss, at most once per rescanInterval for all sockets,
+// since a process opening many sockets would have them read for every new
+// inode. Sockets missing from the tables, e.g. netlink ones, are cached
+// with their link as name.
+class SocketResolver {
+public:
+  // Returns a name for the target of an fd link such as "socket:[1234]" at
+  // CLOCK_MONOTONIC time now; other links are returned unchanged. Sockets
+  // not looked up yet keep their link until a later call.
+  std::string name(pid_t pid, const std::string &link, uint64_t now);
+  // Whether a name is the link of a socket not looked up yet.
+  bool pending(const std::string &name) const;
+
+private:
+  static constexpr uint64_t rescanInterval{100'000'000};
+  static constexpr size_t maxCached{65536};
+  std::unordered_map<uint64_t, std::string> cache;
+  uint64_t lastScan{0};
+  static uint64_t socketInode(const std::string &link);
+  void scan(pid_t pid);
+  void scanInet(pid_t pid, const char *table, bool v6);
+  void scanUnix(pid_t pid);
+};
@@ -0,0 +1,319 @@
+#include "symbolizer.hpp"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <fstream>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Symbolizer::Symbolizer() {
+  thread = std::thread(&Symbolizer::threadRoutine, this);
+}
+
+Symbolizer::~Symbolizer() {
+  {
+    std::lock_guard lck(mtx);
+    stopReq = true;
+  }
+  cv.notify_one();
+  thread.join();
+}
+
+void Symbolizer::setMaps(pid_t pid, std::vector<Mapping> mappings) {
+  std::lock_guard lck(mtx);
+  if (maps.size() >= maxProcesses && !maps.contains(pid))
+    maps.clear();
+  maps[pid] = std::move(mappings);
+}
+
+void Symbolizer::request(pid_t pid, const std::vector<uint64_t> &addrs) {
+  {
+    std::lock_guard lck(mtx);
+    queue.emplace_back(pid, addrs);
+  }
+  cv.notify_one();
+}
+
+void Symbolizer::flush() {
+  std::unique_lock lck(mtx);
+  cvIdle.wait(lck, [this] { return (queue.empty() && !busy) || stopReq; });
+}
+
+std::string Symbolizer::name(pid_t pid, uint64_t addr) const {
+  {
+    std::lock_guard lck(mtx);
+    if (auto it = names.find({pid, addr}); it != names.end())
+      return it->second;
+  }
+  return hex(addr);
+}
+
+void Symbolizer::threadRoutine() {
+  std::unique_lock lck(mtx);
+  while (!stopReq) {
+    cv.wait(lck, [this] { return stopReq || !queue.empty(); });
+    if (stopReq)
+      break;
+    auto [pid, addrs] = std::move(queue.front());
+    queue.pop_front();
+    // Stacks share most of their addresses.
+    std::erase_if(addrs, [this, pid](uint64_t addr) {
+      return names.contains({pid, addr});
+    });
+    busy = true;
+    lck.unlock();
+    // Maps are read again at most once per request, when an address is
+    // outside of the cached ones, and each module file is opened once.
+    bool mapsRead{false};
+    FileKeys files;
+    std::vector<std::pair<uint64_t, std::string>> resolved;
+    for (uint64_t addr : addrs)
+      resolved.emplace_back(addr, resolve(pid, addr, mapsRead, files));
+    lck.lock();
+    for (auto &[addr, name] : resolved) {
+      if (names.size() >= maxNames)
+        break;
+      names.try_emplace({pid, addr}, std::move(name));
+    }
+    busy = false;
+    if (queue.empty())
+      cvIdle.notify_all();
+  }
+  cvIdle.notify_all();
+}
+
+std::string Symbolizer::resolve(pid_t pid, uint64_t addr, bool &mapsRead,
+                                FileKeys &files) {
+  auto m = findMapping(pid, addr, mapsRead);
+  if (!m)
+    return hex(addr);
+  auto slash = m->path.rfind('/');
+  std::string moduleName =
+      slash == std::string::npos ? m->path : m->path.substr(slash + 1);
+  uint64_t fileOffset = addr - m->start + m->offset;
+  if (m->path.empty() || m->path.front() != '/')
+    return moduleName + "+" + hex(addr - m->start);
+  const Module &mod = module(pid, m->path, files);
+  auto seg = std::find_if(mod.segments.cbegin(), mod.segments.cend(),
+                          [&](const Segment &s) {
+                            return fileOffset >= s.offset &&
+                                   fileOffset < s.offset + s.size;
+                          });
+  if (seg == mod.segments.cend())
+    return moduleName + "+" + hex(fileOffset);
+  uint64_t vaddr = fileOffset - seg->offset + seg->vaddr;
+  // Addresses are mostly return addresses, which may be the first byte
+  // after the calling function.
+  auto it = std::upper_bound(
+      mod.symbols.cbegin(), mod.symbols.cend(), vaddr - 1,
+      [](uint64_t a, const Symbol &sym) { return a < sym.addr; });
+  if (it == mod.symbols.cbegin())
+    return moduleName + "+" + hex(fileOffset);
+  --it;
+  if (it->size && vaddr - 1 >= it->addr + it->size)
+    return moduleName + "+" + hex(fileOffset);
+  return moduleName + "!" + it->name + "+" + hex(vaddr - it->addr);
+}
+
+std::optional<Symbolizer::Mapping>
+Symbolizer::findMapping(pid_t pid, uint64_t addr, bool &mapsRead) {
+  auto lookup = [addr](const std::vector<Mapping> &ranges)
+      -> std::optional<Mapping> {
+    auto it = std::upper_bound(
+        ranges.cbegin(), ranges.cend(), addr,
+        [](uint64_t a, const Mapping &m) { return a < m.start; });
+    if (it == ranges.cbegin() || addr >= std::prev(it)->end)
+      return std::nullopt;
+    return *std::prev(it);
+  };
+  {
+    std::lock_guard lck(mtx);
+    if (auto it = maps.find(pid); it != maps.end()) {
+      if (auto m = lookup(it->second))
+        return m;
+    }
+  }
+  if (mapsRead)
+    return std::nullopt;
+  mapsRead = true;
+  // Maps of a process which is gone are kept.
+  auto ranges = readMaps(pid);
+  auto m = lookup(ranges);
+  if (!ranges.empty())
+    setMaps(pid, std::move(ranges));
+  return m;
+}
+
+const Symbolizer::Module &Symbolizer::module(pid_t pid,
+                                             const std::string &path,
+                                             FileKeys &files) {
+  static const Module none{};
+  auto [file, inserted] = files.try_emplace(path);
+  if (!inserted) {
+    if (auto it = modules.find(file->second); it != modules.end())
+      return it->second;
+    // Files which failed to open are not retried; modules dropped with
+    // the others since are loaded again.
+    if (file->second == FileKey{})
+      return none;
+  }
+  // The path is in the mount namespace of the process, which is used while
+  // the process is alive; the same path may be another file elsewhere.
+  std::string rootPath = "/proc/" + std::to_string(pid) + "/root" + path;
+  int fd = open(rootPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    if (fd != -1)
+      close(fd);
+    return none;
+  }
+  FileKey key{st.st_dev, st.st_ino};
+  file->second = key;
+  auto it = modules.find(key);
+  if (it == modules.end()) {
+    if (modules.size() >= maxModules)
+      modules.clear();
+    it = modules.try_emplace(key).first;
+    if (!loadElf(fd, it->second))
+      it->second = {};
+  }
+  close(fd);
+  return it->second;
+}
+
+std::vector<Symbolizer::Mapping> Symbolizer::readMaps(pid_t pid) {
+  std::vector<Mapping> ranges;
+  std::ifstream file("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(file, line)) {
+    // address perms offset dev inode [path]
+    Mapping m{};
+    const char *p = line.data(), *end = line.data() + line.size();
+    auto r = std::from_chars(p, end, m.start, 16);
+    if (r.ec != std::errc() || r.ptr == end || *r.ptr != '-')
+      continue;
+    r = std::from_chars(r.ptr + 1, end, m.end, 16);
+    if (r.ec != std::errc() || end - r.ptr < 6 || r.ptr[3] != 'x')
+      continue;
+    r = std::from_chars(r.ptr + 6, end, m.offset, 16);
+    if (r.ec != std::errc())
+      continue;
+    size_t pos = r.ptr - line.data();
+    for (int field = 0; field < 2 && pos != line.npos; ++field) {
+      pos = line.find_first_not_of(' ', pos);
+      if (pos != line.npos)
+        pos = line.find(' ', pos);
+    }
+    if (pos != line.npos)
+      pos = line.find_first_not_of(' ', pos);
+    if (pos != line.npos)
+      m.path = line.substr(pos);
+    static constexpr std::string_view deleted{" (deleted)"};
+    if (m.path.ends_with(deleted))
+      m.path.resize(m.path.size() - deleted.size());
+    ranges.push_back(std::move(m));
+  }
+  return ranges;
+}
+
+bool Symbolizer::loadElf(int fd, Module &module) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(Elf64_Ehdr))
+    return false;
+  size_t size = st.st_size;
+  void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED)
+    return false;
+  const char *data = static_cast<const char *>(addr);
+  // Every offset and count comes from the file and is checked against its
+  // size; structures are copied out since they may be unaligned.
+  auto fits = [size](uint64_t offset, uint64_t count, uint64_t entrySize) {
+    return offset <= size && (size - offset) / entrySize >= count;
+  };
+  auto get = [data](auto &value, uint64_t offset) {
+    memcpy(&value, data + offset, sizeof(value));
+  };
+  constexpr unsigned char hostData{std::endian::native == std::endian::little
+                                       ? ELFDATA2LSB
+                                       : ELFDATA2MSB};
+  Elf64_Ehdr eh;
+  get(eh, 0);
+  bool ok = !memcmp(eh.e_ident, ELFMAG, SELFMAG) &&
+            eh.e_ident[EI_CLASS] == ELFCLASS64 &&
+            eh.e_ident[EI_DATA] == hostData &&
+            eh.e_phentsize == sizeof(Elf64_Phdr) &&
+            fits(eh.e_phoff, eh.e_phnum, sizeof(Elf64_Phdr));
+  for (size_t i = 0; ok && i < eh.e_phnum; ++i) {
+    Elf64_Phdr ph;
+    get(ph, eh.e_phoff + i * sizeof(ph));
+    if (ph.p_type == PT_LOAD)
+      module.segments.push_back({ph.p_offset, ph.p_filesz, ph.p_vaddr});
+  }
+  std::vector<Elf64_Shdr> sections;
+  if (ok && eh.e_shentsize == sizeof(Elf64_Shdr) &&
+      fits(eh.e_shoff, eh.e_shnum, sizeof(Elf64_Shdr))) {
+    sections.resize(eh.e_shnum);
+    for (size_t i = 0; i < sections.size(); ++i)
+      get(sections[i], eh.e_shoff + i * sizeof(Elf64_Shdr));
+  }
+  // Stripped files only have the dynamic symbols.
+  auto symtab = std::find_if(sections.cbegin(), sections.cend(),
+                             [](auto &sh) { return sh.sh_type == SHT_SYMTAB; });
+  if (symtab == sections.cend())
+    symtab = std::find_if(sections.cbegin(), sections.cend(), [](auto &sh) {
+      return sh.sh_type == SHT_DYNSYM;
+    });
+  if (symtab != sections.cend() && symtab->sh_link < sections.size()) {
+    const Elf64_Shdr &strtab = sections[symtab->sh_link];
+    size_t count = symtab->sh_size / sizeof(Elf64_Sym);
+    if (fits(symtab->sh_offset, count, sizeof(Elf64_Sym)) &&
+        fits(strtab.sh_offset, strtab.sh_size, 1)) {
+      const char *strings = data + strtab.sh_offset;
+      for (size_t i = 0; i < count; ++i) {
+        Elf64_Sym sym;
+        get(sym, symtab->sh_offset + i * sizeof(sym));
+        int type = ELF64_ST_TYPE(sym.st_info);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+            sym.st_shndx == SHN_UNDEF || !sym.st_value ||
+            sym.st_name >= strtab.sh_size)
+          continue;
+        size_t len =
+            strnlen(strings + sym.st_name, strtab.sh_size - sym.st_name);
+        module.symbols.push_back(
+            {sym.st_value, sym.st_size,
+             demangle(std::string(strings + sym.st_name, len))});
+      }
+    }
+  }
+  munmap(addr, size);
+  std::sort(module.symbols.begin(), module.symbols.end(),
+            [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+  return ok;
+}
+
+std::string Symbolizer::demangle(const std::string &name) {
+  if (!name.starts_with("_Z"))
+    return name;
+  int status{0};
+  char *demangled =
+      abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+  if (!demangled)
+    return name;
+  std::string ret(demangled);
+  free(demangled);
+  return ret;
+}
+
+std::string Symbolizer::hex(uint64_t value) {
+  char buf[2 + 16 + 1]{'0', 'x'};
+  auto r = std::to_chars(buf + 2, buf + sizeof(buf) - 1, value, 16);
+  return std::string(buf, r.ptr);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Resolves code addresses of traced processes to "module!function+0xoff"
+// in a background thread. The mappings of a process are set by the tracer
+// while the addresses are valid, since the process may be gone by the time
+// they are requested; they are read from /proc/<pid>/maps otherwise.
+// Function names come from the .symtab or .dynsym section of the mapped ELF
+// files, which are parsed once per device and inode and cached.
+class Symbolizer {
+public:
+  struct Mapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    std::string path;
+  };
+  Symbolizer();
+  Symbolizer(const Symbolizer &) = delete;
+  Symbolizer &operator=(const Symbolizer &) = delete;
+  ~Symbolizer();
+  void setMaps(pid_t pid, std::vector<Mapping> mappings);
+  void request(pid_t pid, const std::vector<uint64_t> &addrs);
+  // Waits until the requested addresses are resolved.
+  void flush();
+  // The address in hex until it is resolved.
+  std::string name(pid_t pid, uint64_t addr) const;
+  // Executable mappings of a process, sorted by address.
+  static std::vector<Mapping> readMaps(pid_t pid);
+
+private:
+  struct Segment {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t vaddr;
+  };
+  struct Symbol {
+    uint64_t addr;
+    uint64_t size;
+    std::string name;
+  };
+  struct Module {
+    std::vector<Segment> segments;
+    // Sorted by address.
+    std::vector<Symbol> symbols;
+  };
+  using FileKey = std::pair<uint64_t, uint64_t>;
+  // Device and inode of the files opened for a request by path, zero if
+  // they could not be opened.
+  using FileKeys = std::unordered_map<std::string, FileKey>;
+  static constexpr size_t maxModules{1024};
+  static constexpr size_t maxProcesses{4096};
+  static constexpr size_t maxNames{1 << 20};
+  // Symbolizer thread state, by device and inode of the opened file.
+  std::map<FileKey, Module> modules;
+  // Shared state.
+  std::unordered_map<pid_t, std::vector<Mapping>> maps;
+  std::deque<std::pair<pid_t, std::vector<uint64_t>>> queue;
+  // Addresses beyond maxNames stay unresolved.
+  std::map<std::pair<pid_t, uint64_t>, std::string> names;
+  bool busy{false};
+  bool stopReq{false};
+  mutable std::mutex mtx;
+  std::condition_variable cv, cvIdle;
+  std::thread thread;
+  void threadRoutine();
+  std::string resolve(pid_t pid, uint64_t addr, bool &mapsRead,
+                      FileKeys &files);
+  std::optional<Mapping> findMapping(pid_t pid, uint64_t addr,
+                                    bool &mapsRead);
+  const Module &module(pid_t pid, const std::string &path, FileKeys &files);
+  static bool loadElf(int fd, Module &module);
+  static std::string demangle(const std::string &name);
+  static std::string hex(uint64_t value);
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <asm/unistd.h>
+#include <cstddef>
+#include <cstdint>
+
+// How the tracer handles the exit of a syscall.
+enum class SyscallKind : uint8_t {
+  None,
+  Read,
+  Write,
+  Open,
+  Close,
+  Dup,
+  Fcntl,
+  CloseAll,
+  Exec,
+  Map,
+  Sync,
+  MapSync,
+  Rename,
+  Unlink,
+};
+
+// Argument indexes of a traced syscall, -1 where the syscall has no such
+// argument. Paths without a directory fd are relative to the working
+// directory.
+struct SyscallDesc {
+  SyscallKind kind{SyscallKind::None};
+  int8_t fd{-1};
+  int8_t path{-1};
+  int8_t dirFd{-1};
+  int8_t newPath{-1};
+  int8_t newDirFd{-1};
+};
+
+namespace syscalls {
+// Large enough for the syscall numbers of x86_64 and the generic table
+// used by aarch64 and riscv64; an entry beyond it fails to compile.
+inline constexpr size_t tableSize{512};
+
+consteval std::array<SyscallDesc, tableSize> makeTable() {
+  using K = SyscallKind;
+  std::array<SyscallDesc, tableSize> t{};
+  // Legacy syscalls such as open and rename only exist on older
+  // architectures, newer ones have just the *at variants.
+  for (long nr : {__NR_read, __NR_readv, __NR_preadv, __NR_preadv2,
+                  __NR_pread64, __NR_recvfrom, __NR_recvmsg})
+    t[nr] = {K::Read, 0};
+  for (long nr : {__NR_write, __NR_writev, __NR_pwritev, __NR_pwritev2,
+                  __NR_pwrite64, __NR_sendto, __NR_sendmsg})
+    t[nr] = {K::Write, 0};
+#ifdef __NR_creat
+  t[__NR_creat] = {K::Open};
+#endif
+#ifdef __NR_open
+  t[__NR_open] = {K::Open};
+#endif
+  t[__NR_openat] = {K::Open};
+  t[__NR_openat2] = {K::Open};
+  t[__NR_close] = {K::Close, 0};
+  t[__NR_dup] = {K::Dup};
+#ifdef __NR_dup2
+  t[__NR_dup2] = {K::Dup};
+#endif
+  t[__NR_dup3] = {K::Dup};
+  t[__NR_fcntl] = {K::Fcntl};
+  t[__NR_close_range] = {K::CloseAll};
+  for (long nr : {__NR_execve, __NR_execveat})
+    t[nr] = {K::Exec};
+  t[__NR_mmap] = {K::Map, 4};
+  for (long nr : {__NR_fsync, __NR_fdatasync, __NR_sync_file_range,
+                  __NR_syncfs})
+    t[nr] = {K::Sync, 0};
+  t[__NR_msync] = {K::MapSync};
+#ifdef __NR_rename
+  t[__NR_rename] = {K::Rename, -1, 0, -1, 1, -1};
+#endif
+#ifdef __NR_renameat
+  t[__NR_renameat] = {K::Rename, -1, 1, 0, 3, 2};
+#endif
+  t[__NR_renameat2] = {K::Rename, -1, 1, 0, 3, 2};
+#ifdef __NR_unlink
+  t[__NR_unlink] = {K::Unlink, -1, 0};
+#endif
+  t[__NR_unlinkat] = {K::Unlink, -1, 1, 0};
+  return t;
+}
+
+inline constexpr std::array<SyscallDesc, tableSize> table{makeTable()};
+} // namespace syscalls
+
+// Descriptor of a traced syscall, null for syscalls the tracer ignores.
+constexpr const SyscallDesc *syscallDesc(uint64_t nr) {
+  if (nr >= syscalls::tableSize)
+    return nullptr;
+  const SyscallDesc &desc = syscalls::table[nr];
+  return desc.kind == SyscallKind::None ? nullptr : &desc;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+// Open addressing hash table keyed by thread id, with linear probing and
+// backward shift deletion, for per-thread state looked up at every
+// syscall stop. Zero is not a valid key. Pointers returned by find() are
+// invalidated by insertions and removals.
+template <typename T> class TidMap {
+public:
+  T *find(pid_t tid) {
+    if (slots.empty())
+      return nullptr;
+    for (size_t i = home(tid);; i = next(i)) {
+      if (slots[i].tid == tid)
+        return &slots[i].value;
+      if (!slots[i].tid)
+        return nullptr;
+    }
+  }
+
+  bool contains(pid_t tid) const {
+    return const_cast<TidMap *>(this)->find(tid) != nullptr;
+  }
+
+  T &operator[](pid_t tid) {
+    if ((count + 1) * 2 > slots.size())
+      grow();
+    size_t i = home(tid);
+    for (; slots[i].tid; i = next(i))
+      if (slots[i].tid == tid)
+        return slots[i].value;
+    slots[i].tid = tid;
+    ++count;
+    return slots[i].value;
+  }
+
+  bool erase(pid_t tid) {
+    if (slots.empty())
+      return false;
+    size_t i = home(tid);
+    for (; slots[i].tid != tid; i = next(i))
+      if (!slots[i].tid)
+        return false;
+    // Following entries of the probe sequence are moved back into the gap
+    // unless their home slot lies after it.
+    for (size_t j = next(i); slots[j].tid; j = next(j)) {
+      size_t h = home(slots[j].tid);
+      bool stays = i <= j ? (i < h && h <= j) : (i < h || h <= j);
+      if (!stays) {
+        slots[i] = std::move(slots[j]);
+        i = j;
+      }
+    }
+    slots[i] = Slot{};
+    --count;
+    return true;
+  }
+
+  size_t size() const { return count; }
+
+private:
+  struct Slot {
+    pid_t tid{0};
+    T value{};
+  };
+  static constexpr size_t minSize{64};
+  std::vector<Slot> slots;
+  size_t count{0};
+
+  size_t home(pid_t tid) const {
+    // Fibonacci hashing spreads consecutive thread ids.
+    return (uint32_t(tid) * 2654435769u) & (slots.size() - 1);
+  }
+
+  size_t next(size_t i) const { return (i + 1) & (slots.size() - 1); }
+
+  void grow() {
+    std::vector<Slot> old(std::max(minSize, slots.size() * 2));
+    old.swap(slots);
+    count = 0;
+    for (auto &slot : old)
+      if (slot.tid)
+        (*this)[slot.tid] = std::move(slot.value);
+  }
+};
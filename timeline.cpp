@@ -0,0 +1,121 @@
+#include "timeline.hpp"
+#include "log.hpp"
+#include <charconv>
+#include <iterator>
+
+Timeline::Timeline(const std::string &path, uint64_t minDuration)
+    : file(path, std::ios::binary | std::ios::trunc),
+      minDuration(minDuration) {
+  if (!file) {
+    LOGE("Failed to create timeline #.", path);
+    return;
+  }
+  buffer.reserve(bufferSize + 4096);
+  buffer += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  success = true;
+}
+
+Timeline::~Timeline() {
+  if (!success)
+    return;
+  buffer += "\n]}\n";
+  flush();
+}
+
+void Timeline::add(const EventInfo &ei) {
+  if (!success || ei.type == Event::Exit || ei.duration < minDuration)
+    return;
+  beginRecord();
+  buffer += "{\"name\":\"";
+  buffer += eventNames[static_cast<size_t>(ei.type)];
+  buffer += "\",\"cat\":\"file\",\"ph\":\"X\",\"ts\":";
+  appendTime(ei.time - ei.duration);
+  buffer += ",\"dur\":";
+  appendTime(ei.duration);
+  buffer += ",\"pid\":";
+  appendNumber(ei.tgid);
+  buffer += ",\"tid\":";
+  appendNumber(ei.pid);
+  buffer += ",\"args\":{\"path\":";
+  appendString(ei.path);
+  if (ei.type == Event::Read || ei.type == Event::Write) {
+    buffer += ",\"bytes\":";
+    appendNumber(ei.sizeArg);
+  }
+  if (ei.type == Event::Rename) {
+    buffer += ",\"to\":";
+    appendString(ei.strArg);
+  }
+  if (ei.fd >= 0) {
+    buffer += ",\"fd\":";
+    appendNumber(ei.fd);
+  }
+  // Coalesced reads and writes span from the first entry to the last exit.
+  if (ei.count > 1) {
+    buffer += ",\"count\":";
+    appendNumber(ei.count);
+  }
+  buffer += "}}";
+  if (buffer.size() >= bufferSize)
+    flush();
+}
+
+void Timeline::nameThread(pid_t tid, pid_t pid, const std::string &name) {
+  if (!success)
+    return;
+  beginRecord();
+  buffer += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":";
+  appendNumber(pid);
+  buffer += ",\"tid\":";
+  appendNumber(tid);
+  buffer += ",\"args\":{\"name\":";
+  appendString(name);
+  buffer += "}}";
+}
+
+Timeline::operator bool() const { return success; }
+
+void Timeline::beginRecord() {
+  if (!first)
+    buffer += ",\n";
+  first = false;
+}
+
+void Timeline::appendNumber(uint64_t value) {
+  char buf[20];
+  auto r = std::to_chars(std::begin(buf), std::end(buf), value);
+  buffer.append(buf, r.ptr);
+}
+
+void Timeline::appendTime(uint64_t ns) {
+  appendNumber(ns / 1000);
+  char frac[4]{'.', char('0' + ns / 100 % 10), char('0' + ns / 10 % 10),
+               char('0' + ns % 10)};
+  buffer.append(frac, sizeof(frac));
+}
+
+void Timeline::appendString(std::string_view str) {
+  static constexpr char hex[]{"0123456789abcdef"};
+  buffer += '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      buffer += '\\';
+      buffer += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      buffer += "\\u00";
+      buffer += hex[c >> 4];
+      buffer += hex[c & 0xf];
+    } else {
+      buffer += c;
+    }
+  }
+  buffer += '"';
+}
+
+void Timeline::flush() {
+  if (!file.write(buffer.data(), buffer.size())) {
+    LOGE("Failed to write timeline, it is no longer written.");
+    success = false;
+  }
+  buffer.clear();
+}
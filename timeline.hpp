@@ -0,0 +1,41 @@
+#pragma once
+
+#include "event.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+// Traced syscalls in the Chrome Trace Event JSON format, to be loaded in
+// Perfetto UI or chrome://tracing: one complete ("X") event per syscall,
+// from its entry to its exit, on the track of its thread. Events are
+// formatted into a buffer which is written out when full; the file is only
+// valid JSON once closed.
+class Timeline {
+public:
+  // Syscalls shorter than minDuration nanoseconds are left out.
+  Timeline(const std::string &path, uint64_t minDuration);
+  Timeline(const Timeline &) = delete;
+  Timeline &operator=(const Timeline &) = delete;
+  ~Timeline();
+  void add(const EventInfo &event);
+  // Names the track of a thread.
+  void nameThread(pid_t tid, pid_t pid, const std::string &name);
+  operator bool() const;
+
+private:
+  static constexpr size_t bufferSize{1 << 20};
+  std::ofstream file;
+  std::string buffer;
+  uint64_t minDuration;
+  bool first{true};
+  bool success{false};
+  void beginRecord();
+  void appendNumber(uint64_t value);
+  // Nanoseconds as fractional microseconds.
+  void appendTime(uint64_t ns);
+  void appendString(std::string_view str);
+  void flush();
+};
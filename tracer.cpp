@@ -1,54 +1,68 @@
 #include "tracer.hpp"
 #include "log.hpp"
 #include <algorithm>
-#include <asm/unistd.h>
 #include <charconv>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <ctype.h>
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iterator>
+#include <linux/close_range.h>
+#include <linux/fs.h>
 #include <linux/limits.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-sig_atomic_t Tracer::terminate{0};
+// Real-time signal of the process reserved for interrupting tracers.
+static const int wakeSignal{SIGRTMAX};
 
-Tracer::Tracer(pid_t pid) : mainPid(pid) {
+Tracer::Tracer(const std::vector<pid_t> &pids, const std::string &cgroup) {
   if (!setSignalHandler())
     return;
-  cmdLine = getCmdLine();
-  auto threads = getProcThreads();
-  if (threads.empty())
-    return;
-  for (auto p : threads) {
-    if (ptrace(PTRACE_ATTACH, p, nullptr, nullptr) == -1) {
-      LOGPE("ptrace (ATTACH)");
-      return;
-    }
-    if (waitpid(p, nullptr, 0) == -1) {
-      LOGPE("waitpid");
+  if (!cgroup.empty()) {
+    // Accept both a cgroupfs directory and a path as shown in
+    // /proc/<pid>/cgroup.
+    this->cgroup = cgroup;
+    if (!std::filesystem::exists(this->cgroup + "/cgroup.procs"))
+      this->cgroup = cgroupRoot + cgroup;
+    if (!std::filesystem::exists(this->cgroup + "/cgroup.procs")) {
+      LOGE("Not a cgroup directory: #.", cgroup);
       return;
     }
-    if (ptrace(PTRACE_SETOPTIONS, p, nullptr, options) == -1) {
-      LOGPE("ptrace (SETOPTIONS)");
-      return;
-    }
-    if (ptrace(PTRACE_SYSCALL, p, 0, 0) == -1) {
-      LOGPE("ptrace (SYSCALL)");
+  }
+  timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  stats->attachTime = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  std::set<pid_t> procs(pids.cbegin(), pids.cend());
+  procs.merge(getCgroupProcs());
+  for (auto pid : procs) {
+    if (!attachProcess(pid)) {
+      // Processes attached so far are released.
+      if (!pids.empty())
+        detachAll();
       return;
     }
   }
+  if (!pids.empty())
+    mainPid = pids.front();
+  else if (!procs.empty())
+    mainPid = *procs.begin();
+  cmdLine = mainPid ? getCmdLine(mainPid) : "cgroup " + this->cgroup;
   attached = true;
-  LOGI("Attached to process with PID # [# thread(s)].", mainPid,
-       threads.size());
 }
 
 Tracer::Tracer(char *const *argv) {
@@ -59,9 +73,14 @@ Tracer::Tracer(char *const *argv) {
     LOGPE("fork");
   } else if (mainPid == 0) {
     spawnTracee(argv);
+    // The logging thread does not exist in the child.
+    Logger::instance().flush();
+    _exit(EXIT_FAILURE);
   } else {
+    // The child stops itself before exec and is seized while stopped, so
+    // that it can be interrupted like attached processes.
     int status{0};
-    if (waitpid(mainPid, &status, 0) == -1) {
+    if (waitpid(mainPid, &status, WUNTRACED) == -1) {
       LOGPE("waitpid");
       return;
     }
@@ -69,15 +88,17 @@ Tracer::Tracer(char *const *argv) {
       LOGE("Unexpected wait status: #0x#\n", std::hex, status);
       return;
     }
-    cmdLine = getCmdLine();
-    if (ptrace(PTRACE_SETOPTIONS, mainPid, nullptr, options) != 0) {
-      LOGPE("ptrace (SETOPTIONS)");
+    cmdLine = getCmdLine(mainPid);
+    if (ptrace(PTRACE_SEIZE, mainPid, nullptr, options) != 0) {
+      LOGPE("ptrace (SEIZE)");
       return;
     }
-    if (ptrace(PTRACE_SYSCALL, mainPid, 0, 0) < 0) {
-      LOGPE("ptrace (SYSCALL)");
+    if (kill(mainPid, SIGCONT) == -1) {
+      LOGPE("kill (SIGCONT)");
       return;
     }
+    pids.insert(mainPid);
+    tgids[mainPid] = mainPid;
     spawned = true;
     LOGI("Forked (PID #).", mainPid);
   }
@@ -85,36 +106,222 @@ Tracer::Tracer(char *const *argv) {
 
 Tracer::~Tracer() {
   LOGI("Tracer termination reason: #.", strerror(lastErr));
+  for (auto [pid, fd] : pidfds) {
+    if (fd != -1)
+      close(fd);
+  }
   if (spawned) {
     kill(mainPid, SIGTERM);
     LOGI("Sent SIGTERM to tracee (PID #).", mainPid);
   } else if (attached) {
-    auto threads = getProcThreads();
-    size_t n{0};
+    detachAll();
+  }
+}
+
+bool Tracer::attachProcess(pid_t pid) {
+  // Threads are seized and interrupted without waiting for them to stop;
+  // the stops are handled by the main loop. Rescan until no new threads
+  // show up, threads cloned by seized ones are attached by the kernel.
+  std::set<pid_t> seized;
+  for (size_t scanned = 0;; scanned = seized.size()) {
+    auto threads = getProcThreads(pid);
+    if (threads.empty() && seized.empty())
+      return false;
     for (auto p : threads) {
-      if (tgkill(mainPid, p, SIGSTOP) == -1) {
-        LOGPE("tgkill(SIGSTOP)");
+      if (seized.contains(p))
         continue;
+      if (ptrace(PTRACE_SEIZE, p, nullptr, options) == -1) {
+        if (errno == ESRCH || (errno == EPERM && tracerOf(p) == getpid()))
+          continue;
+        LOGPE("ptrace (SEIZE)");
+        // Not retried by cgroup scans while it is a member.
+        unattachable.insert(pid);
+        detachSeized(seized);
+        return false;
       }
-      waitpid(p, nullptr, 0);
-      if (ptrace(PTRACE_DETACH, p, nullptr, nullptr) == -1) {
-        LOGPE("ptrace(DETACH)");
+      seized.insert(p);
+      tgids[p] = pid;
+      if (ptrace(PTRACE_INTERRUPT, p, nullptr, nullptr) == -1) {
+        LOGPE("ptrace (INTERRUPT)");
         continue;
       }
-      if (tgkill(mainPid, p, SIGCONT) == -1)
-        LOGPE("tgkill(SIGCONT)");
-      else
+      interrupted[p] = monotonicTime();
+    }
+    if (seized.size() == scanned)
+      break;
+  }
+  pids.insert(pid);
+  LOGI("Attached to process with PID # [# thread(s)].", pid, seized.size());
+  return true;
+}
+
+static bool detachStopped(pid_t tid, int status) {
+  // Pass signals on, ptrace stops carry none.
+  int sig = WSTOPSIG(status);
+  bool signalStop = status >> 16 == 0 && (sig & ~0x80) != SIGTRAP;
+  if (ptrace(PTRACE_DETACH, tid, nullptr, signalStop ? sig : 0) == 0)
+    return true;
+  LOGPE("ptrace (DETACH)");
+  return false;
+}
+
+void Tracer::detachSeized(const std::set<pid_t> &tids) {
+  // The threads of a process which could not be attached completely; the
+  // interrupted ones are detached once they report their stop.
+  for (auto tid : tids) {
+    tgids.erase(tid);
+    if (!interrupted.erase(tid)) {
+      ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+      continue;
+    }
+    int status;
+    pid_t ret;
+    do
+      ret = waitpid(tid, &status, __WALL | __WNOTHREAD);
+    while (ret == -1 && errno == EINTR);
+    if (ret == tid && WIFSTOPPED(status))
+      detachStopped(tid, status);
+  }
+}
+
+void Tracer::detachAll() {
+  size_t n{0};
+  auto detach = [&n](pid_t tid, int status) {
+    if (detachStopped(tid, status))
+      ++n;
+  };
+  std::set<pid_t> reaped;
+  for (auto [tid, status] : stops) {
+    if (WIFSTOPPED(status)) {
+      detach(tid, status);
+      reaped.insert(tid);
+    }
+  }
+  stops.clear();
+  // Threads already in a ptrace-stop are detached at once, running ones are
+  // interrupted and detached when their stops are reported.
+  std::unordered_map<pid_t, uint64_t> stopping;
+  for (auto pid : pids) {
+    for (auto tid : getProcThreads(pid)) {
+      if (reaped.contains(tid))
+        continue;
+      if (ptrace(PTRACE_DETACH, tid, nullptr, nullptr) == 0)
         ++n;
+      else if (ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) == 0)
+        stopping[tid] = monotonicTime();
+    }
+  }
+  uint64_t maxPause{0};
+  while (!stopping.empty()) {
+    int status;
+    pid_t tid = waitpid(-1, &status, __WALL | __WNOTHREAD);
+    if (tid == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (WIFSTOPPED(status))
+      detach(tid, status);
+    if (auto it = stopping.find(tid); it != stopping.end()) {
+      maxPause = std::max(maxPause, monotonicTime() - it->second);
+      stopping.erase(it);
+    }
+  }
+  LOGI("Detached from # thread(s), max pause # us.", n, maxPause / 1000);
+}
+
+void Tracer::resumed(pid_t tid) {
+  auto it = interrupted.find(tid);
+  if (it == interrupted.end())
+    return;
+  maxAttachPause = std::max(maxAttachPause, monotonicTime() - it->second);
+  interrupted.erase(it);
+  if (interrupted.empty()) {
+    LOGI("Attach completed, max pause # us.", maxAttachPause / 1000);
+    maxAttachPause = 0;
+  }
+}
+
+pid_t Tracer::tracerOf(pid_t tid) {
+  std::ifstream file("/proc/" + std::to_string(tid) + "/status");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.starts_with("TracerPid:")) {
+      pid_t pid{0};
+      auto p = line.data() + line.find_first_not_of(" \t", 10);
+      std::from_chars(p, line.data() + line.size(), pid);
+      return pid;
+    }
+  }
+  return 0;
+}
+
+void Tracer::forgetThread(pid_t tid) {
+  state.erase(tid);
+  tgids.erase(tid);
+  if (pids.erase(tid)) {
+    auto ofProcess = [tid](const auto &p) {
+      return pid_t(p.first >> 32) == tid;
+    };
+    std::erase_if(trackedFds, ofProcess);
+    std::erase_if(openedFds, ofProcess);
+  }
+}
+
+pid_t Tracer::processOf(pid_t tid) {
+  if (auto it = tgids.find(tid); it != tgids.end())
+    return it->second;
+  // New threads are reported by TRACECLONE before their first stop.
+  pid_t pid = tid;
+  std::ifstream file("/proc/" + std::to_string(tid) + "/status");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.starts_with("Tgid:")) {
+      auto p = line.data() + line.find_first_not_of(" \t", 5);
+      std::from_chars(p, line.data() + line.size(), pid);
+      break;
     }
-    LOGI("Detached from process with PID # [# thread(s)].", mainPid, n);
   }
+  tgids[tid] = pid;
+  return pid;
 }
 
 void Tracer::setOutputCallback(EventCallback cb) { callback = cb; }
 
-std::set<pid_t> Tracer::getProcThreads() {
+void Tracer::setBacklogCallback(std::function<size_t()> cb) {
+  backlogCallback = cb;
+}
+
+void Tracer::setTickCallback(std::function<void()> cb) { tickCallback = cb; }
+
+void Tracer::setSampling(std::chrono::milliseconds on,
+                         std::chrono::milliseconds period) {
+  sampleOn = std::chrono::nanoseconds(on).count();
+  samplePeriod = std::chrono::nanoseconds(period).count();
+}
+
+void Tracer::setSymbolizer(std::shared_ptr<Symbolizer> s) { symbolizer = s; }
+
+std::shared_ptr<const TracerStats> Tracer::statistics() const {
+  return stats;
+}
+
+void Tracer::setFilter(std::shared_ptr<const Filter> f) {
+  std::lock_guard lck(mtxFilter);
+  pendingFilter = f;
+  filterChanged = true;
+}
+
+void Tracer::updateFilter() {
+  std::lock_guard lck(mtxFilter);
+  filter = std::move(pendingFilter);
+  filterChanged = false;
+  trackedFds.clear();
+}
+
+std::set<pid_t> Tracer::getProcThreads(pid_t pid) {
   std::set<pid_t> ret;
-  std::string s = "/proc/" + std::to_string(mainPid) + "/task";
+  std::string s = "/proc/" + std::to_string(pid) + "/task";
   try {
     for (const auto &dir_entry : std::filesystem::directory_iterator{s}) {
       if (auto s = dir_entry.path().filename().string(); !s.empty()) {
@@ -131,6 +338,181 @@ std::set<pid_t> Tracer::getProcThreads() {
   return ret;
 }
 
+std::set<int> Tracer::getProcFds(pid_t pid) {
+  std::set<int> ret;
+  std::string s = "/proc/" + std::to_string(pid) + "/fd";
+  std::error_code ec;
+  for (const auto &dir_entry : std::filesystem::directory_iterator{s, ec}) {
+    auto name = dir_entry.path().filename().string();
+    int fd;
+    auto [ptr, err] = std::from_chars(name.data(), name.data() + name.size(),
+                                      fd);
+    if (err == std::errc() && ptr == name.data() + name.size())
+      ret.insert(fd);
+  }
+  return ret;
+}
+
+std::set<pid_t> Tracer::getCgroupProcs() {
+  std::set<pid_t> ret;
+  if (cgroup.empty())
+    return ret;
+  std::ifstream file(cgroup + "/cgroup.procs");
+  if (!file) {
+    LOGE("Failed to open #/cgroup.procs.", cgroup);
+    return ret;
+  }
+  pid_t p;
+  while (file >> p) {
+    if (p != getpid())
+      ret.insert(p);
+  }
+  return ret;
+}
+
+void Tracer::tickerRoutine() {
+  // Interrupts the blocking waitpid in the tracer thread so that periodic
+  // work runs there, without racing with ptrace calls.
+  std::unique_lock lck(mtxTicker);
+  for (;;) {
+    std::chrono::steady_clock::time_point deadline{
+        std::chrono::nanoseconds(nextTick(monotonicTime()))};
+    if (cvTicker.wait_until(lck, deadline, [this] { return stopTicker; }))
+      break;
+    tickReq = true;
+    pthread_kill(tracerThread, wakeSignal);
+  }
+}
+
+uint64_t Tracer::nextTick(uint64_t now) const {
+  uint64_t next = now + std::chrono::nanoseconds(overloadCheckInterval).count();
+  if (!samplePeriod)
+    return next;
+  uint64_t phase = (now - startTime) % samplePeriod;
+  return std::min(next,
+                  now - phase + (phase < sampleOn ? sampleOn : samplePeriod));
+}
+
+void Tracer::onTick() {
+  uint64_t now = monotonicTime();
+  tickTime = now;
+  flushPendingEvent();
+  if (tickCallback)
+    tickCallback();
+  checkLoad(now);
+  if (samplePeriod) {
+    bool inWindow = (now - startTime) % samplePeriod < sampleOn;
+    if (inWindow != tracing)
+      setTracing(inWindow, now);
+    stats->elapsedTime = now - startTime;
+  }
+  if (!cgroup.empty() &&
+      std::chrono::nanoseconds(now - lastScan) >= cgroupScanInterval) {
+    lastScan = now;
+    auto procs = getCgroupProcs();
+    std::erase_if(unattachable,
+                  [&procs](pid_t pid) { return !procs.contains(pid); });
+    for (auto pid : procs) {
+      if (!pids.contains(pid) && !unattachable.contains(pid))
+        attachProcess(pid);
+    }
+  }
+}
+
+void Tracer::checkLoad(uint64_t now) {
+  if (std::chrono::nanoseconds(now - lastLoadCheck) < overloadCheckInterval)
+    return;
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  uint64_t cpuTime = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  double cpuShare = double(cpuTime - lastCpuTime) / (now - lastLoadCheck);
+  lastCpuTime = cpuTime;
+  lastLoadCheck = now;
+  size_t backlog = backlogCallback ? backlogCallback() : 0;
+  int level = static_cast<int>(degradation);
+  if (backlog > backlogHigh ||
+      (backlog > backlogLow && cpuShare > busyCpuShare)) {
+    calmChecks = 0;
+    if (degradation != Degradation::Counters)
+      setDegradation(static_cast<Degradation>(level + 1), backlog);
+  } else if (backlog < backlogLow && degradation != Degradation::None) {
+    if (++calmChecks >= calmChecksToRecover) {
+      calmChecks = 0;
+      setDegradation(static_cast<Degradation>(level - 1), backlog);
+    }
+  } else {
+    calmChecks = 0;
+  }
+}
+
+void Tracer::setDegradation(Degradation level, size_t backlog) {
+  if (level > degradation)
+    LOGW("Output is # events behind, degrading to #.", backlog,
+         degradationNames[static_cast<int>(level)]);
+  else
+    LOGI("Output caught up, degradation reduced to #.",
+         degradationNames[static_cast<int>(level)]);
+  degradation = level;
+  if (degradation < Degradation::Coalesce)
+    flushPendingEvent();
+  stats->degradation = level;
+  if (level > stats->maxDegradation)
+    stats->maxDegradation = level;
+  stats->degradationChanges.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Tracer::timestamped(const SyscallDesc &desc) const {
+  // Sync durations are always measured.
+  return degradation < Degradation::NoTimestamps ||
+         desc.kind == SyscallKind::Sync || desc.kind == SyscallKind::MapSync;
+}
+
+void Tracer::emit(EventInfo &&ei) {
+  stats->events.fetch_add(1, std::memory_order_relaxed);
+  if (degradation >= Degradation::Coalesce &&
+      (ei.type == Event::Read || ei.type == Event::Write)) {
+    if (pendingEvent.pid == ei.pid && pendingEvent.type == ei.type &&
+        pendingEvent.path == ei.path && pendingEvent.stack == ei.stack) {
+      pendingEvent.sizeArg += ei.sizeArg;
+      // The merged event spans from the first entry to the last exit.
+      pendingEvent.duration += std::max(ei.time, pendingEvent.time) -
+                               pendingEvent.time;
+      pendingEvent.time = std::max(ei.time, pendingEvent.time);
+      ++pendingEvent.count;
+      return;
+    }
+    flushPendingEvent();
+    pendingEvent = std::move(ei);
+    return;
+  }
+  flushPendingEvent();
+  callback(ei);
+}
+
+void Tracer::flushPendingEvent() {
+  if (!pendingEvent.pid)
+    return;
+  callback(pendingEvent);
+  pendingEvent = {};
+}
+
+void Tracer::setTracing(bool on, uint64_t now) {
+  // Outside of the window threads are resumed with PTRACE_CONT at their next
+  // stop; entering it, they are interrupted to be resumed with
+  // PTRACE_SYSCALL again.
+  tracing = on;
+  if (on) {
+    windowStart = now;
+    // Fds closed in between were not traced, their numbers may be reused.
+    trackedFds.clear();
+    openedFds.clear();
+    for (const auto &[tid, pid] : tgids)
+      ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+  } else {
+    stats->sampledTime += now - windowStart;
+  }
+}
+
 std::string Tracer::readLink(const std::string &path, bool *pExists) {
   std::string out(PATH_MAX, 0);
   if (readlink(path.data(), out.data(), out.size()) == -1) {
@@ -140,8 +522,12 @@ std::string Tracer::readLink(const std::string &path, bool *pExists) {
   if (size_t len = out.find('\0'); len != std::string::npos)
     out.resize(len);
   bool exists{true};
+  // The suffix is also there when another link of the file is left, or may
+  // be part of the name; the link itself leads to the file.
   static const std::string deleted = " (deleted)";
-  if (out.ends_with(deleted) && !std::filesystem::exists(out)) {
+  struct stat st;
+  if (out.ends_with(deleted) && stat(path.c_str(), &st) == 0 &&
+      st.st_nlink == 0) {
     out.erase(out.size() - deleted.size());
     exists = false;
   }
@@ -150,36 +536,160 @@ std::string Tracer::readLink(const std::string &path, bool *pExists) {
   return out;
 }
 
-std::pair<std::string, bool> Tracer::filePath(int fd) {
+std::pair<std::string, bool> Tracer::filePath(pid_t pid, int fd) {
   if (fd < 0)
     return {invalidFd, false};
   const char *std[] = {"*STDIN*", "*STDOUT*", "*STDERR*"};
   if (fd <= 2)
     return {std[fd], true};
   std::string linkPath =
-      "/proc/" + std::to_string(mainPid) + "/fd/" + std::to_string(fd);
+      "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(fd);
   bool exists;
-  std::string path = readLink(linkPath, &exists);
+  std::string path =
+      sockets.name(pid, readLink(linkPath, &exists), monotonicTime());
   return {path, exists};
 }
 
-std::string Tracer::filePath(int dirFd, const std::string &relPath) {
+std::optional<Tracer::TrackedFd> Tracer::trackedFile(pid_t pid, int fd) {
+  auto it = trackedFds.find(fdKey(pid, fd));
+  if (it != trackedFds.end()) {
+    const TrackedFd &file = it->second;
+    // While degraded the last path is reused even if it may be stale.
+    bool degraded = degradation >= Degradation::HotFdsOnly;
+    // Sockets not looked up yet get their path and verdict again.
+    bool settled = !file.unnamed || degraded;
+    if (settled && !file.passes)
+      return std::nullopt;
+    bool fresh = file.pathChanges == pathChanges &&
+                 std::chrono::nanoseconds(tickTime - file.resolveTime) <
+                     pathRefreshInterval;
+    if (settled && (fresh || degraded))
+      return file;
+  } else if (degradation >= Degradation::HotFdsOnly) {
+    // New fds are not resolved.
+    return TrackedFd{true, unresolvedFd};
+  }
+  auto [path, exists] = filePath(pid, fd);
+  if (path == invalidFd)
+    return TrackedFd{true, invalidFd, false};
+  // Another link target may be another file, at an fd number reused after
+  // a close which was not traced.
+  if (it == trackedFds.end() || it->second.path != path) {
+    if (it == trackedFds.end())
+      it = trackedFds.emplace(fdKey(pid, fd), TrackedFd{}).first;
+    TrackedFd &file = it->second;
+    file.passes = pathPasses(path);
+    // Standard streams keep their names rather than the file's.
+    file.id = file.passes && fd > 2 ? fileId(pid, fd) : FileId{};
+  }
+  TrackedFd &file = it->second;
+  file.unnamed = sockets.pending(path);
+  file.path = std::move(path);
+  file.exists = exists;
+  file.resolveTime = tickTime;
+  file.pathChanges = pathChanges;
+  if (!file.passes)
+    return std::nullopt;
+  return file;
+}
+
+FileId Tracer::fileId(pid_t pid, int fd) {
+  // The fd is duplicated from the tracee rather than the file opened again,
+  // which would open devices and FIFOs. The duplicate shares the tracee's
+  // open file, so closing it does not release the file either.
+  auto [it, inserted] = pidfds.try_emplace(pid, -1);
+  if (inserted)
+    it->second = syscall(SYS_pidfd_open, pid, 0);
+  int dup = it->second == -1 ? -1 : syscall(SYS_pidfd_getfd, it->second, fd, 0);
+  struct stat st;
+  if (dup == -1) {
+    // The fd link leads to the same file, without its generation.
+    std::string linkPath =
+        "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(fd);
+    if (stat(linkPath.c_str(), &st) == -1)
+      return {};
+    return {st.st_dev, st.st_ino};
+  }
+  FileId id;
+  if (fstat(dup, &st) == 0) {
+    id = {st.st_dev, st.st_ino};
+    // Device drivers may give the ioctl number another meaning.
+    long generation{0};
+    if ((S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) &&
+        ioctl(dup, FS_IOC_GETVERSION, &generation) == 0)
+      id.generation = generation;
+  }
+  close(dup);
+  return id;
+}
+
+EventInfo Tracer::fileEvent(pid_t tid, Event type, const TrackedFd &file) {
+  EventInfo ei{tid, type, file.path, file.exists};
+  ei.id = file.id;
+  return ei;
+}
+
+bool Tracer::pathPasses(const std::string &path) const {
+  if (path.empty())
+    return false;
+  return !filter || filter->matches(path);
+}
+
+std::string Tracer::filePath(pid_t pid, int dirFd,
+                             const std::string &relPath) {
   if (relPath.empty() || relPath.front() == '/')
     return relPath;
   std::string dir;
   if (dirFd == AT_FDCWD) {
-    std::string linkPath = "/proc/" + std::to_string(mainPid) + "/cwd";
+    std::string linkPath = "/proc/" + std::to_string(pid) + "/cwd";
     dir = readLink(linkPath);
   } else {
-    dir = filePath(dirFd).first;
+    dir = filePath(pid, dirFd).first;
   }
   if (dir.empty())
     return relPath;
   return dir + '/' + relPath;
 }
 
-std::string Tracer::getCmdLine() {
-  std::string path = "/proc/" + std::to_string(mainPid) + "/cmdline";
+std::pair<std::string, bool> Tracer::mappedFilePath(pid_t pid, uint64_t addr) {
+  std::string path = "/proc/" + std::to_string(pid) + "/maps";
+  std::ifstream file(path);
+  if (!file) {
+    LOGE("Failed to open #.", path);
+    return {invalidFd, false};
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    const char *p = line.data(), *end = p + line.size();
+    uint64_t from, to;
+    auto r = std::from_chars(p, end, from, 16);
+    if (r.ec != std::errc() || r.ptr == end || *r.ptr != '-')
+      continue;
+    r = std::from_chars(r.ptr + 1, end, to, 16);
+    if (r.ec != std::errc() || addr < from || addr >= to)
+      continue;
+    // Skip perms, offset, dev and inode fields.
+    const char *q = r.ptr;
+    for (int field = 0; field < 4 && q != end; ++field) {
+      while (q != end && *q == ' ')
+        ++q;
+      while (q != end && *q != ' ')
+        ++q;
+    }
+    while (q != end && *q == ' ')
+      ++q;
+    std::string mapped(q, end);
+    static const std::string deleted = " (deleted)";
+    bool exists = !mapped.ends_with(deleted);
+    if (!exists)
+      mapped.erase(mapped.size() - deleted.size());
+    return {mapped, exists};
+  }
+  return {invalidFd, false};
+}
+
+std::string Tracer::getCmdLine(pid_t pid) {
+  std::string path = "/proc/" + std::to_string(pid) + "/cmdline";
   std::ifstream file(path);
   if (!file)
     return {};
@@ -212,25 +722,37 @@ std::string Tracer::readString(pid_t tid, void *addr) {
   return data.chars;
 }
 
-void Tracer::signalHandler(int) { terminate = 1; }
+uint64_t Tracer::monotonicTime() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t Tracer::fdKey(pid_t pid, int fd) {
+  return uint64_t(pid) << 32 | uint32_t(fd);
+}
+
+int Tracer::argDirFd(const uint64_t *args, int index) {
+  return index < 0 ? AT_FDCWD : int(args[index]);
+}
+
+void Tracer::wakeHandler(int) {}
 
 bool Tracer::setSignalHandler() {
-  struct sigaction act {};
-  sigemptyset(&act.sa_mask);
-  act.sa_handler = &Tracer::signalHandler;
-  if (sigaction(SIGINT, &act, nullptr) == 0 &&
-      sigaction(SIGTERM, &act, nullptr) == 0) {
-    return true;
-  }
-  LOGPE("sigaction");
-  return false;
+  // Shared by all tracers of the process; the handler only makes waitpid
+  // fail with EINTR, so it is installed without SA_RESTART.
+  static const bool installed = [] {
+    struct sigaction act {};
+    sigemptyset(&act.sa_mask);
+    act.sa_handler = &Tracer::wakeHandler;
+    return sigaction(wakeSignal, &act, nullptr) == 0;
+  }();
+  if (!installed)
+    LOGPE("sigaction");
+  return installed;
 }
 
 bool Tracer::spawnTracee(char *const *argv) {
-  if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0) {
-    LOGPE("ptrace (TRACEME)");
-    return false;
-  }
   if (raise(SIGSTOP)) {
     LOGPE("raise (SIGSTOP)");
     return false;
@@ -242,22 +764,54 @@ bool Tracer::spawnTracee(char *const *argv) {
   return true;
 }
 
+pid_t Tracer::waitStop(int &status) {
+  // Stops are collected in batches and handled in order, otherwise threads
+  // early in the kernel's list of tracees starve the others. Only tracees
+  // of this thread are waited for, the others belong to other tracers.
+  if (stops.empty()) {
+    pid_t tid = waitpid(-1, &status, __WALL | __WNOTHREAD);
+    if (tid <= 0)
+      return tid;
+    stops.emplace_back(tid, status);
+    while ((tid = waitpid(-1, &status, __WALL | __WNOTHREAD | WNOHANG)) > 0)
+      stops.emplace_back(tid, status);
+  }
+  pid_t tid = stops.front().first;
+  status = stops.front().second;
+  stops.pop_front();
+  return tid;
+}
+
 bool Tracer::iteration() {
   pid_t tid;
   do {
+    // A busy tracee keeps waitpid from ever being interrupted.
+    if (stopReq) {
+      LOGI("Termination requested.");
+      lastErr = EINTR;
+      return false;
+    }
+    if (tickReq.exchange(false))
+      onTick();
     int status;
-    tid = waitpid(-1, &status, __WALL);
+    tid = waitStop(status);
     lastErr = errno;
     if (tid == -1) {
       switch (errno) {
       case EINTR: {
-        if (terminate)
+        if (stopReq)
           LOGI("Termination requested.");
         else
           tid = 0;
         break;
       }
       case ECHILD: {
+        if (!cgroup.empty() && !stopReq) {
+          // All members exited; wait for the next scan or termination.
+          pause();
+          tid = 0;
+          break;
+        }
         LOGW("Tracee exited.");
         spawned = attached = false;
         break;
@@ -270,19 +824,51 @@ bool Tracer::iteration() {
     }
     if (tid > 0) {
       if (WIFSTOPPED(status)) {
+        // Known threads are interrupted when a sampling window starts.
+        if (samplePeriod)
+          processOf(tid);
         int sig = WSTOPSIG(status);
         bool sysTrap = sig == (SIGTRAP | 0x80);
         if (sysTrap && !handleSyscall(tid))
           return false;
-        int corrSig = (sig == SIGTRAP || sig == (SIGTRAP | 0x80)) ? 0 : sig;
-        if (ptrace(PTRACE_SYSCALL, tid, 0, corrSig) == -1) {
+        int event = status >> 16;
+        int corrSig = (sig == SIGTRAP || sysTrap || event) ? 0 : sig;
+        // A group-stop of a seized tracee must persist until SIGCONT.
+        bool groupStop = event == PTRACE_EVENT_STOP && sig != SIGTRAP;
+        auto request = tracing ? PTRACE_SYSCALL : PTRACE_CONT;
+        if (groupStop ? ptrace(PTRACE_LISTEN, tid, 0, 0) == -1
+                      : ptrace(request, tid, 0, corrSig) == -1) {
           lastErr = errno;
+          // The thread may be killed while stopped, its exit comes later.
+          if (lastErr == ESRCH) {
+            tid = 0;
+            continue;
+          }
           LOGPE("ptrace (SYSCALL)");
           return false;
         }
+        resumed(tid);
         if (!sysTrap)
           tid = 0;
       } else {
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+          // The leader is reported last, its fds are closed by now.
+          if (callback && processOf(tid) == tid) {
+            EventInfo ei{tid, Event::Exit, {}};
+            ei.tgid = tid;
+            ei.time = monotonicTime();
+            emit(std::move(ei));
+          }
+          if (processOf(tid) == tid) {
+            codeRanges.erase(tid);
+            if (auto it = pidfds.find(tid); it != pidfds.end()) {
+              if (it->second != -1)
+                close(it->second);
+              pidfds.erase(it);
+            }
+          }
+          forgetThread(tid);
+        }
         tid = 0;
       }
     }
@@ -291,6 +877,10 @@ bool Tracer::iteration() {
 }
 
 bool Tracer::handleSyscall(pid_t tid) {
+  // Outside of sampling windows only exits of traced entries are handled.
+  if (!tracing && !state.contains(tid))
+    return true;
+  stats->syscallStops.fetch_add(1, std::memory_order_relaxed);
   __ptrace_syscall_info si{};
   constexpr size_t sz{sizeof(__ptrace_syscall_info)};
   if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, sz, &si) == -1) {
@@ -298,123 +888,429 @@ bool Tracer::handleSyscall(pid_t tid) {
     LOGPE("ptrace (GET_SYSCALL_INFO)");
     return false;
   }
+  if (filterChanged.load(std::memory_order_relaxed))
+    updateFilter();
   if (si.op == PTRACE_SYSCALL_INFO_ENTRY) {
+    auto desc = syscallDesc(si.entry.nr);
+    if (!desc) {
+      // A stale state of a thread whose exit stop was missed would be
+      // taken for this syscall's.
+      state.erase(tid);
+      return true;
+    }
+    pid_t pid = processOf(tid);
     auto &st = state[tid];
-    st.nr = si.entry.nr;
+    st.desc = desc;
     std::copy(std::begin(si.entry.args), std::end(si.entry.args),
               std::begin(st.args));
-    if (st.nr == __NR_close)
-      closingFiles[tid] = filePath(st.args[0]).first;
-  } else if (si.op == PTRACE_SYSCALL_INFO_EXIT) {
-    auto it = state.find(tid);
-    if (it == state.end()) {
-      LOGE("Unexpected syscall state.");
-      return false;
+    st.entryTime = timestamped(*desc) ? monotonicTime() : tickTime;
+    st.closing.reset();
+    if (desc->kind == SyscallKind::Close &&
+        degradation != Degradation::Counters)
+      st.closing = trackedFile(pid, st.args[desc->fd]);
+    st.stack.clear();
+    bool stacked = desc->kind == SyscallKind::Read ||
+                   desc->kind == SyscallKind::Write ||
+                   desc->kind == SyscallKind::Open ||
+                   desc->kind == SyscallKind::Sync;
+    if (symbolizer && stacked && degradation < Degradation::HotFdsOnly) {
+      // Fds known not to pass the filter are not worth the walk.
+      auto fd = desc->fd >= 0 ? trackedFds.find(fdKey(pid, st.args[desc->fd]))
+                              : trackedFds.end();
+      if (fd == trackedFds.end() || fd->second.passes)
+        captureStack(tid, pid, si, st.stack);
     }
-    uint64_t nr = it->second.nr;
+  } else if (si.op == PTRACE_SYSCALL_INFO_EXIT) {
+    // Untraced syscalls and entries before the sampling window have no
+    // state.
+    auto st = state.find(tid);
+    if (!st)
+      return true;
+    pid_t pid = processOf(tid);
+    const SyscallDesc &desc = *st->desc;
+    uint64_t exitTime = timestamped(desc) ? monotonicTime() : tickTime;
     int64_t rval = si.exit.rval;
-    uint64_t *args = it->second.args;
+    uint64_t *args = st->args;
     if (rval >= 0) {
+      updateTrackedFds(pid, desc, args, rval);
+      reportImplicitCloses(tid, pid, desc, args, rval, exitTime);
+    }
+    if (rval >= 0 && degradation == Degradation::Counters) {
+      countUnlisted(desc, args, rval);
+    } else if (rval >= 0) {
       EventInfo ei{};
-      switch (nr) {
-      case __NR_read:
-      case __NR_readv:
-      case __NR_preadv:
-      case __NR_preadv2:
-      case __NR_pread64: {
-        auto [path, exists] = filePath(args[0]);
-        ei = {tid, Event::Read, path, exists, (size_t)rval};
+      switch (desc.kind) {
+      case SyscallKind::Read: {
+        if (auto file = trackedFile(pid, args[desc.fd])) {
+          ei = fileEvent(tid, Event::Read, *file);
+          ei.sizeArg = rval;
+        }
         break;
       }
-      case __NR_write:
-      case __NR_writev:
-      case __NR_pwritev:
-      case __NR_pwritev2:
-      case __NR_pwrite64: {
-        auto [path, exists] = filePath(args[0]);
-        ei = {tid, Event::Write, path, exists, (size_t)rval};
+      case SyscallKind::Write: {
+        if (auto file = trackedFile(pid, args[desc.fd])) {
+          ei = fileEvent(tid, Event::Write, *file);
+          ei.sizeArg = rval;
+        }
         break;
       }
-      case __NR_creat:
-      case __NR_open:
-      case __NR_openat:
-      case __NR_openat2: {
-        auto [path, exists] = filePath(rval);
-        ei = {tid, Event::Open, path, exists};
+      case SyscallKind::Open: {
+        if (auto file = trackedFile(pid, rval)) {
+          ei = fileEvent(tid, Event::Open, *file);
+          ei.fd = rval;
+          openedFds[fdKey(pid, rval)] = *file;
+        }
         break;
       }
-      case __NR_close: {
-        if (auto it = closingFiles.find(tid); it != closingFiles.end()) {
-          ei = {tid, Event::Close, it->second};
-          closingFiles.erase(it);
+      case SyscallKind::Close: {
+        if (st->closing) {
+          ei = fileEvent(tid, Event::Close, *st->closing);
+          ei.exists = true;
+          ei.fd = args[desc.fd];
         }
         break;
       }
-      case __NR_mmap: {
-        int fd = args[4];
+      case SyscallKind::Map: {
         int flags = args[3];
         if (!(flags & MAP_ANONYMOUS)) {
-          auto [path, exists] = filePath(fd);
-          ei = {tid, Event::Map, path, exists};
+          if (auto file = trackedFile(pid, args[desc.fd]))
+            ei = fileEvent(tid, Event::Map, *file);
         }
         break;
       }
-      case __NR_rename:
-      case __NR_renameat:
-      case __NR_renameat2: {
-        std::string from, to;
-        int dirFrom, dirTo;
-        void *pFrom, *pTo;
-        if (nr == __NR_rename) {
-          dirFrom = dirTo = AT_FDCWD;
-          pFrom = (void *)args[0];
-          pTo = (void *)args[1];
-        } else {
-          dirFrom = args[0];
-          dirTo = args[2];
-          pFrom = (void *)args[1];
-          pTo = (void *)args[3];
-        }
-        from = filePath(dirFrom, readString(tid, pFrom));
-        to = filePath(dirTo, readString(tid, pTo));
-        ei = {tid, Event::Rename, from, true, 0, to};
+      case SyscallKind::Sync: {
+        if (auto file = trackedFile(pid, args[desc.fd]))
+          ei = fileEvent(tid, Event::Sync, *file);
         break;
       }
-      case __NR_unlink:
-      case __NR_unlinkat: {
-        int dir;
-        void *pPath;
-        if (nr == __NR_unlink) {
-          dir = AT_FDCWD;
-          pPath = (void *)args[0];
-        } else {
-          dir = args[0];
-          pPath = (void *)args[1];
-        }
-        std::string path = filePath(dir, readString(tid, pPath));
-        ei = {tid, Event::Unlink, path, false};
+      case SyscallKind::MapSync: {
+        auto [path, exists] = mappedFilePath(pid, args[0]);
+        if (pathPasses(path))
+          ei = {tid, Event::Sync, path, exists};
+        break;
+      }
+      case SyscallKind::Rename: {
+        std::string from = filePath(pid, argDirFd(args, desc.dirFd),
+                                    readString(tid, (void *)args[desc.path]));
+        std::string to =
+            filePath(pid, argDirFd(args, desc.newDirFd),
+                     readString(tid, (void *)args[desc.newPath]));
+        if (pathPasses(from) || pathPasses(to))
+          ei = {tid, Event::Rename, from, true, 0, to};
+        break;
+      }
+      case SyscallKind::Unlink: {
+        std::string path = filePath(pid, argDirFd(args, desc.dirFd),
+                                    readString(tid, (void *)args[desc.path]));
+        if (pathPasses(path))
+          ei = {tid, Event::Unlink, path, false};
         break;
       }
       default: {
         break;
       }
       }
-      if (ei.pid && callback)
-        callback(ei);
+      if (ei.pid && callback) {
+        ei.tgid = pid;
+        ei.time = exitTime;
+        // Either time may be a tick time while the ladder is changing.
+        ei.duration = std::max(exitTime, st->entryTime) - st->entryTime;
+        ei.stack = std::move(st->stack);
+        emit(std::move(ei));
+      }
     }
-    state.erase(it);
+    state.erase(tid);
   }
   return true;
 }
 
+void Tracer::captureStack(pid_t tid, pid_t pid,
+                          const __ptrace_syscall_info &si,
+                          std::vector<uint64_t> &stack) {
+  stack.push_back(si.instruction_pointer);
+  isCode(pid, si.instruction_pointer, true);
+  user_regs_struct regs;
+  iovec iov{&regs, sizeof(regs)};
+  if (ptrace(PTRACE_GETREGSET, tid, NT_PRSTATUS, &iov) == -1)
+    return;
+#if defined(__x86_64__)
+  uint64_t fp = regs.rbp, link = 0;
+#elif defined(__aarch64__)
+  uint64_t fp = regs.regs[29], link = regs.regs[30];
+#else
+  uint64_t fp = 0, link = 0;
+#endif
+  // The window is split at page boundaries, so that a read crossing the
+  // end of the stack mapping returns the pages before it.
+  constexpr size_t pageSize{4096};
+  constexpr size_t windowWords{stackWindowSize / sizeof(uint64_t)};
+  uint64_t sp = si.stack_pointer;
+  uint64_t window[windowWords];
+  iovec remote[stackWindowSize / pageSize + 1];
+  size_t chunks{0};
+  for (uint64_t addr = sp; addr < sp + stackWindowSize; ++chunks) {
+    uint64_t end = std::min(sp + stackWindowSize, (addr / pageSize + 1) *
+                                                      pageSize);
+    remote[chunks] = {reinterpret_cast<void *>(addr), end - addr};
+    addr = end;
+  }
+  iovec local{window, sizeof(window)};
+  ssize_t n = process_vm_readv(tid, &local, 1, remote, chunks, 0);
+  size_t words = n > 0 ? n / sizeof(uint64_t) : 0;
+  auto readWord = [&](uint64_t addr, uint64_t &value) {
+    if (addr >= sp && (addr - sp) / sizeof(uint64_t) < words) {
+      value = window[(addr - sp) / sizeof(uint64_t)];
+      return true;
+    }
+    iovec l{&value, sizeof(value)};
+    iovec r{reinterpret_cast<void *>(addr), sizeof(value)};
+    return process_vm_readv(tid, &l, 1, &r, 1, 0) == sizeof(value);
+  };
+  // Syscall wrappers are leaf functions without a frame of their own: the
+  // return address into their caller is in the link register, or is taken
+  // to be the first code address on the stack below the caller's frame.
+  if (link) {
+    if (isCode(pid, link))
+      stack.push_back(link);
+  } else {
+    for (size_t i = 0; i < std::min(words, leafScanWords) &&
+                       (fp < sp || sp + i * sizeof(uint64_t) < fp);
+         ++i) {
+      if (isCode(pid, window[i])) {
+        stack.push_back(window[i]);
+        break;
+      }
+    }
+  }
+  // Each frame starts with the caller's frame pointer and the return
+  // address; frames are above the stack pointer and go up.
+  while (stack.size() < maxFrames && fp >= sp &&
+         fp % sizeof(uint64_t) == 0) {
+    uint64_t next, ret;
+    if (!readWord(fp, next) || !readWord(fp + sizeof(uint64_t), ret) ||
+        !isCode(pid, ret))
+      break;
+    if (ret != stack.back())
+      stack.push_back(ret);
+    if (next <= fp)
+      break;
+    fp = next;
+  }
+}
+
+bool Tracer::isCode(pid_t pid, uint64_t addr, bool knownCode) {
+  auto contains = [addr](const std::vector<Symbolizer::Mapping> &maps) {
+    auto it = std::upper_bound(
+        maps.cbegin(), maps.cend(), addr,
+        [](uint64_t a, const Symbolizer::Mapping &m) { return a < m.start; });
+    return it != maps.cbegin() && addr < std::prev(it)->end;
+  };
+  auto &code = codeRanges[pid];
+  if (contains(code.mappings))
+    return true;
+  uint64_t now = monotonicTime();
+  if (!knownCode && code.readTime &&
+      std::chrono::nanoseconds(now - code.readTime) < codeRangesInterval)
+    return false;
+  code.mappings = Symbolizer::readMaps(pid);
+  code.readTime = now;
+  symbolizer->setMaps(pid, code.mappings);
+  return contains(code.mappings);
+}
+
+void Tracer::updateTrackedFds(pid_t pid, const SyscallDesc &desc,
+                              const uint64_t *args, int64_t rval) {
+  switch (desc.kind) {
+  case SyscallKind::Open:
+  case SyscallKind::Dup: {
+    trackedFds.erase(fdKey(pid, rval));
+    break;
+  }
+  case SyscallKind::Close: {
+    trackedFds.erase(fdKey(pid, args[desc.fd]));
+    break;
+  }
+  case SyscallKind::Fcntl: {
+    if (args[1] == F_DUPFD || args[1] == F_DUPFD_CLOEXEC)
+      trackedFds.erase(fdKey(pid, rval));
+    break;
+  }
+  case SyscallKind::CloseAll:
+  case SyscallKind::Exec: {
+    std::erase_if(trackedFds, [pid](const auto &p) {
+      return pid_t(p.first >> 32) == pid;
+    });
+    break;
+  }
+  case SyscallKind::Rename:
+  case SyscallKind::Unlink: {
+    // Paths of tracked fds may have changed.
+    ++pathChanges;
+    break;
+  }
+  default: {
+    break;
+  }
+  }
+}
+
+void Tracer::reportImplicitCloses(pid_t tid, pid_t pid,
+                                  const SyscallDesc &desc,
+                                  const uint64_t *args, int64_t rval,
+                                  uint64_t time) {
+  std::vector<uint64_t> closed;
+  auto closedIf = [&](auto pred) {
+    for (const auto &[key, file] : openedFds) {
+      if (pid_t(key >> 32) == pid && pred(uint32_t(key)))
+        closed.push_back(key);
+    }
+  };
+  switch (desc.kind) {
+  case SyscallKind::Open:
+  case SyscallKind::Dup:
+  case SyscallKind::Fcntl: {
+    // dup2 and dup3 close the fd they duplicate to; other new fds only get
+    // the number of a reported fd whose close was not traced.
+    bool newFd = desc.kind != SyscallKind::Fcntl || args[1] == F_DUPFD ||
+                 args[1] == F_DUPFD_CLOEXEC;
+    bool same = desc.kind == SyscallKind::Dup && uint64_t(rval) == args[0];
+    if (newFd && !same && openedFds.contains(fdKey(pid, rval)))
+      closed.push_back(fdKey(pid, rval));
+    break;
+  }
+  case SyscallKind::Close: {
+    openedFds.erase(fdKey(pid, args[desc.fd]));
+    break;
+  }
+  case SyscallKind::CloseAll: {
+    // Fds are only marked close-on-exec with CLOSE_RANGE_CLOEXEC.
+    if (!(args[2] & CLOSE_RANGE_CLOEXEC))
+      closedIf([args](uint32_t fd) {
+        return fd >= uint32_t(args[0]) && fd <= uint32_t(args[1]);
+      });
+    break;
+  }
+  case SyscallKind::Exec: {
+    // Fds without close-on-exec are left.
+    std::set<int> left = getProcFds(pid);
+    closedIf([&left](uint32_t fd) { return !left.contains(fd); });
+    break;
+  }
+  default: {
+    break;
+  }
+  }
+  for (uint64_t key : closed) {
+    auto it = openedFds.find(key);
+    // Closes are not reported while only counters are.
+    if (callback && degradation != Degradation::Counters) {
+      EventInfo ei = fileEvent(tid, Event::Close, it->second);
+      ei.exists = true;
+      ei.fd = uint32_t(key);
+      ei.tgid = pid;
+      ei.time = time;
+      emit(std::move(ei));
+    }
+    openedFds.erase(it);
+  }
+}
+
+void Tracer::countUnlisted(const SyscallDesc &desc, const uint64_t *args,
+                           int64_t rval) {
+  // Paths are not resolved, so the filter does not apply.
+  Event type;
+  switch (desc.kind) {
+  case SyscallKind::Read: {
+    stats->unlistedReadSize.fetch_add(rval, std::memory_order_relaxed);
+    type = Event::Read;
+    break;
+  }
+  case SyscallKind::Write: {
+    stats->unlistedWriteSize.fetch_add(rval, std::memory_order_relaxed);
+    type = Event::Write;
+    break;
+  }
+  case SyscallKind::Open: {
+    type = Event::Open;
+    break;
+  }
+  case SyscallKind::Close: {
+    type = Event::Close;
+    break;
+  }
+  case SyscallKind::Map: {
+    if (args[3] & MAP_ANONYMOUS)
+      return;
+    type = Event::Map;
+    break;
+  }
+  case SyscallKind::Sync:
+  case SyscallKind::MapSync: {
+    type = Event::Sync;
+    break;
+  }
+  case SyscallKind::Rename: {
+    type = Event::Rename;
+    break;
+  }
+  case SyscallKind::Unlink: {
+    type = Event::Unlink;
+    break;
+  }
+  default: {
+    return;
+  }
+  }
+  stats->unlistedEvents[static_cast<size_t>(type)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
 bool Tracer::loop() {
   if (!(spawned || attached))
     return false;
+  tracerThread = pthread_self();
+  looping = true;
+  startTime = windowStart = lastScan = lastLoadCheck = tickTime =
+      monotonicTime();
+  ticker = std::thread(&Tracer::tickerRoutine, this);
   while (iteration())
     ;
-  return terminate;
+  flushPendingEvent();
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  stats->cpuTime = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  if (samplePeriod) {
+    uint64_t now = monotonicTime();
+    if (tracing)
+      stats->sampledTime += now - windowStart;
+    stats->elapsedTime = now - startTime;
+  }
+  if (ticker.joinable()) {
+    {
+      std::lock_guard lck(mtxTicker);
+      stopTicker = true;
+    }
+    cvTicker.notify_one();
+    ticker.join();
+  }
+  looping = false;
+  // Detach right away, tracees stay stopped until then.
+  if (attached) {
+    detachAll();
+    attached = false;
+  }
+  return stopReq || lastErr == ECHILD;
 }
 
+void Tracer::stop() {
+  // Only async-signal-safe calls.
+  stopReq = true;
+  if (looping)
+    pthread_kill(tracerThread, wakeSignal);
+}
+
+Tracer::operator bool() const { return spawned || attached; }
+
 pid_t Tracer::traceePid() const { return mainPid; }
 
 std::string Tracer::traceeCmdLine() const { return cmdLine; }
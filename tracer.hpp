@@ -1,45 +1,191 @@
 #pragma once
 
 #include "event.hpp"
+#include "filter.hpp"
+#include "sockets.hpp"
+#include "symbolizer.hpp"
+#include "syscalls.hpp"
+#include "tidmap.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
-#include <map>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
 #include <set>
-#include <signal.h>
 #include <string>
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/user.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 class Tracer {
 private:
+  // Whether events on a (process, fd) pair pass the filter, the identity of
+  // the file and the path last resolved for it. The verdict and identity
+  // are obtained again whenever the fd link resolves to another path.
+  struct TrackedFd {
+    bool passes{true};
+    std::string path{};
+    bool exists{true};
+    FileId id{};
+    // Socket not looked up yet, whose path and verdict are not final.
+    bool unnamed{false};
+    // Tick time of the resolution and renames or unlinks traced before it.
+    uint64_t resolveTime{0};
+    uint64_t pathChanges{0};
+  };
   struct SyscallState {
-    uint64_t nr;
+    const SyscallDesc *desc;
     uint64_t args[6];
+    uint64_t entryTime;
+    // Fd being closed, which is gone at the exit.
+    std::optional<TrackedFd> closing;
+    // Code addresses at the entry, innermost first, if stacks are captured.
+    std::vector<uint64_t> stack;
   };
   static constexpr int options{PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE};
   static constexpr const char *invalidFd{"*INVALID FD*"};
+  static constexpr const char *unresolvedFd{"*UNRESOLVED FD*"};
+  static constexpr const char *cgroupRoot{"/sys/fs/cgroup/"};
+  static constexpr std::chrono::seconds cgroupScanInterval{1};
+  // Load is checked every interval: the ladder goes one step down when the
+  // output has more events queued than backlogHigh, or more than backlogLow
+  // while the tracer thread is busy, and one step back up after
+  // calmChecksToRecover checks with fewer than backlogLow.
+  static constexpr std::chrono::milliseconds overloadCheckInterval{250};
+  static constexpr size_t backlogHigh{262144};
+  static constexpr size_t backlogLow{32768};
+  static constexpr double busyCpuShare{0.9};
+  static constexpr int calmChecksToRecover{4};
+  // Stacks are walked through frame pointers, reading the stack in one go
+  // up to stackWindowSize bytes above the stack pointer and word by word
+  // further up. Executable mappings are read again when the instruction
+  // pointer is outside of them, or on other misses at most once per
+  // codeRangesInterval.
+  static constexpr size_t maxFrames{8};
+  static constexpr size_t stackWindowSize{8192};
+  static constexpr size_t leafScanWords{16};
+  static constexpr std::chrono::seconds codeRangesInterval{1};
+  // Paths only name the files of tracked fds: they are resolved again when
+  // a rename or unlink was traced since, otherwise at most once per
+  // pathRefreshInterval, for renames by untraced processes.
+  static constexpr std::chrono::seconds pathRefreshInterval{1};
+  struct CodeRanges {
+    std::vector<Symbolizer::Mapping> mappings;
+    uint64_t readTime{0};
+  };
   pid_t mainPid{0};
+  std::set<pid_t> pids;
+  std::unordered_map<pid_t, pid_t> tgids;
+  std::string cgroup;
   std::string cmdLine;
-  std::map<pid_t, SyscallState> state;
+  // Sampling window and period in nanoseconds, zero if every syscall is
+  // traced.
+  uint64_t sampleOn{0}, samplePeriod{0};
+  // Set if stacks are captured.
+  std::shared_ptr<Symbolizer> symbolizer;
+  std::unordered_map<pid_t, CodeRanges> codeRanges;
+  uint64_t startTime{0}, windowStart{0}, lastScan{0};
+  bool tracing{true};
+  std::shared_ptr<TracerStats> stats{std::make_shared<TracerStats>()};
+  // Traced syscall each thread is in.
+  TidMap<SyscallState> state;
+  std::deque<std::pair<pid_t, int>> stops;
   bool spawned{false}, attached{false};
   int lastErr{0};
-  std::map<pid_t, std::string> closingFiles;
-  static sig_atomic_t terminate;
+  // Interruption time of threads not yet resumed after attach.
+  std::unordered_map<pid_t, uint64_t> interrupted;
+  // Cgroup members which failed to attach.
+  std::set<pid_t> unattachable;
+  uint64_t maxAttachPause{0};
+  // Unknown fds are absent.
+  std::unordered_map<uint64_t, TrackedFd> trackedFds;
+  // Fds whose open was reported, for reporting the closes of those closed
+  // by dup2, close_range or exec.
+  std::unordered_map<uint64_t, TrackedFd> openedFds;
+  // Renames and unlinks traced so far.
+  uint64_t pathChanges{0};
+  // Pidfds of traced processes to duplicate their fds, -1 if unavailable.
+  std::unordered_map<pid_t, int> pidfds;
+  SocketResolver sockets;
+  std::shared_ptr<const Filter> filter, pendingFilter;
+  std::atomic<bool> filterChanged{false};
+  std::mutex mtxFilter;
+  pthread_t tracerThread{};
+  std::thread ticker;
+  std::mutex mtxTicker;
+  std::condition_variable cvTicker;
+  bool stopTicker{false};
+  // Set from other threads and signal handlers, which then interrupt
+  // waitpid in the tracer thread with wakeSignal.
+  std::atomic<bool> stopReq{false}, tickReq{false}, looping{false};
   EventCallback callback;
+  std::function<size_t()> backlogCallback;
+  std::function<void()> tickCallback;
+  Degradation degradation{Degradation::None};
+  uint64_t lastLoadCheck{0}, lastCpuTime{0}, tickTime{0};
+  int calmChecks{0};
+  // Read or write being coalesced with the following ones.
+  EventInfo pendingEvent{};
   bool iteration();
+  pid_t waitStop(int &status);
   bool handleSyscall(pid_t tid);
   bool spawnTracee(char *const *argv);
-  bool setSignalHandler();
-  std::set<pid_t> getProcThreads();
-  std::pair<std::string, bool> filePath(int fd);
-  std::string filePath(int dirFd, const std::string &relPath);
-  std::string getCmdLine();
+  static bool setSignalHandler();
+  bool attachProcess(pid_t pid);
+  void detachSeized(const std::set<pid_t> &tids);
+  void detachAll();
+  void resumed(pid_t tid);
+  pid_t tracerOf(pid_t tid);
+  void forgetThread(pid_t tid);
+  pid_t processOf(pid_t tid);
+  std::set<pid_t> getProcThreads(pid_t pid);
+  std::set<int> getProcFds(pid_t pid);
+  std::set<pid_t> getCgroupProcs();
+  void tickerRoutine();
+  uint64_t nextTick(uint64_t now) const;
+  void onTick();
+  void setTracing(bool on, uint64_t now);
+  void checkLoad(uint64_t now);
+  void setDegradation(Degradation level, size_t backlog);
+  bool timestamped(const SyscallDesc &desc) const;
+  void updateTrackedFds(pid_t pid, const SyscallDesc &desc,
+                        const uint64_t *args, int64_t rval);
+  void reportImplicitCloses(pid_t tid, pid_t pid, const SyscallDesc &desc,
+                            const uint64_t *args, int64_t rval,
+                            uint64_t time);
+  void countUnlisted(const SyscallDesc &desc, const uint64_t *args,
+                     int64_t rval);
+  void captureStack(pid_t tid, pid_t pid, const __ptrace_syscall_info &si,
+                    std::vector<uint64_t> &stack);
+  bool isCode(pid_t pid, uint64_t addr, bool knownCode = false);
+  void emit(EventInfo &&event);
+  void flushPendingEvent();
+  std::pair<std::string, bool> filePath(pid_t pid, int fd);
+  std::optional<TrackedFd> trackedFile(pid_t pid, int fd);
+  FileId fileId(pid_t pid, int fd);
+  static EventInfo fileEvent(pid_t tid, Event type, const TrackedFd &file);
+  bool pathPasses(const std::string &path) const;
+  void updateFilter();
+  std::string filePath(pid_t pid, int dirFd, const std::string &relPath);
+  std::pair<std::string, bool> mappedFilePath(pid_t pid, uint64_t addr);
+  std::string getCmdLine(pid_t pid);
   std::string readLink(const std::string &path, bool *pExists = nullptr);
   std::string readString(pid_t tid, void *addr);
-  static void signalHandler(int);
+  static uint64_t monotonicTime();
+  static uint64_t fdKey(pid_t pid, int fd);
+  static int argDirFd(const uint64_t *args, int index);
+  static void wakeHandler(int);
 
 public:
-  Tracer(pid_t pid);
+  Tracer(const std::vector<pid_t> &pids, const std::string &cgroup);
   Tracer(char *const *argv);
   Tracer(const Tracer &) = delete;
   Tracer &operator=(const Tracer &) = delete;
@@ -47,7 +193,24 @@ public:
   Tracer &operator=(Tracer &&) = delete;
   ~Tracer();
   void setOutputCallback(EventCallback cb);
+  // Reports the number of events the output has not processed yet.
+  void setBacklogCallback(std::function<size_t()> cb);
+  // Called from the tracer thread on every tick, at least once per
+  // overloadCheckInterval.
+  void setTickCallback(std::function<void()> cb);
+  void setFilter(std::shared_ptr<const Filter> filter);
+  void setSampling(std::chrono::milliseconds on,
+                   std::chrono::milliseconds period);
+  // Captures the call stacks of reads, writes, opens and syncs, and passes
+  // the mappings they are in to the symbolizer.
+  void setSymbolizer(std::shared_ptr<Symbolizer> symbolizer);
+  std::shared_ptr<const TracerStats> statistics() const;
+  // Whether the tracee was spawned or attached.
+  operator bool() const;
+  // Traces until the tracees exit or stop() is called.
   bool loop();
+  // Ends loop() from any thread, or from a signal handler.
+  void stop();
   pid_t traceePid() const;
   std::string traceeCmdLine() const;
 };